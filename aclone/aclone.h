@@ -10,6 +10,10 @@ extern "C" {
 #endif
 
 // Key/Value Management
+//
+// Values are opaque byte strings of 'size' bytes, copied on insert.  Small
+// ones are stored inline; larger ones are kept in a single shared buffer
+// that replication and the replay log refer to rather than copy.
 
 struct aclone_key {
 	void* key;
@@ -29,18 +33,117 @@ aclone_context* aclone_context_create(int flags);
 
 void aclone_context_destroy(aclone_context* ctx);
 
+// Completion Queues
+//
+// By default, async request callbacks run on arbitrary libcppa scheduler
+// threads.  Once a completion queue is attached to a context, callbacks for
+// async requests issued through that context are queued there instead and
+// run on whichever thread calls aclone_cq_poll() or aclone_cq_wait(), e.g.
+// after the queue's eventfd polls readable in the application's own event
+// loop.  A queue must outlive the requests completing into it.
+
+struct aclone_completion_queue;
+
+aclone_completion_queue* aclone_cq_create(void);
+
+void aclone_cq_destroy(aclone_completion_queue* cq);
+
+// Readable whenever completions are queued.
+int aclone_cq_fd(const aclone_completion_queue* cq);
+
+// Runs up to max queued callbacks on the calling thread without blocking and
+// returns the number run.
+size_t aclone_cq_poll(aclone_completion_queue* cq, size_t max);
+
+// Like aclone_cq_poll(), but first waits up to timeout seconds (or forever,
+// if negative) for a completion to arrive.
+size_t aclone_cq_wait(aclone_completion_queue* cq, size_t max, double timeout);
+
+// Passing a null queue detaches, restoring callbacks on libcppa threads.
+int aclone_context_attach_cq(aclone_context* ctx, aclone_completion_queue* cq);
+
 // Store Management
 
 struct aclone_store;
 
 const char* aclone_store_get_topic(const aclone_store* store);
 
+// Flags for opening a master.
+enum aclone_master_flags {
+    // Log every update to disk and recover the store from there when the
+    // master is next opened.  See durable_dir.  Should the log become
+    // unwritable, the master ignores further updates and fails
+    // read-modify-writes, rather than apply changes a restart would lose.
+    ACLONE_MASTER_DURABLE = 0x1,
+};
+
+// Encodings snapshot chunks may be sent in.  A cloner offers those it is
+// configured with when it asks for a snapshot, and its master uses those
+// of them that it is configured with too.
+enum aclone_snapshot_codecs {
+    // Each key is sent as the length it shares with the previous key,
+    // which snapshots' sorted keys often do, plus the rest of it.
+    ACLONE_SNAPSHOT_FRONT_CODING = 0x1,
+    // Chunks are compressed with a fast LZ77 codec, trading CPU time on
+    // both ends for fewer bytes on slow links.
+    ACLONE_SNAPSHOT_LZ = 0x2,
+};
+
 aclone_store* aclone_store_open_master(aclone_context* ctx, const char* topic,
                                        int flags);
 
-// TODO: eventually it should be possible for more than one master store
-//       to be served over a single port.
+struct aclone_master_config {
+	// Number of recently published updates the master retains so that
+	// cloners which fall behind or reconnect can replay just the updates
+	// they missed instead of pulling a full snapshot.  Zero disables replay.
+	size_t replay_log_size;
+	// Approximate upper bound on the key/value bytes carried by each chunk
+	// of a streamed snapshot.
+	size_t snapshot_chunk_bytes;
+	// When non-zero, published updates are held for up to this many
+	// microseconds, or until publish_max_ops/publish_max_bytes accumulate,
+	// and then sent to each subscriber as one batch.  This trades
+	// replication latency for fewer, larger messages.
+	uint32_t publish_flush_us;
+	size_t publish_max_ops;
+	size_t publish_max_bytes;
+	// Number of master actors the topic's keys are hash-partitioned
+	// across, each with its own store and sequence, so that writes to one
+	// topic can use as many cores.  Remote and cloner handles discover the
+	// shards when opened and route each key to its owner.
+	size_t shards;
+	// Directory a durable master keeps its files in, named after the topic
+	// and shard: a write-ahead log, synced in group commits by a thread of
+	// its own, and a snapshot written in chunks between updates whenever
+	// compact_bytes have been logged since the last one (never, if zero).
+	// Recovery loads the snapshot and replays the log after it.  The
+	// recovered master has a new epoch, so cloners resynchronize with a
+	// snapshot, as updates that hadn't been synced when it stopped are lost.
+	const char* durable_dir;
+	size_t compact_bytes;
+	// ACLONE_SNAPSHOT_* codecs snapshots may be sent to cloners in.
+	uint32_t snapshot_codecs;
+	// Granularity of the timer wheel that expires keys inserted with a
+	// TTL: a key expires within one tick after its TTL runs out.  The
+	// master only ticks while some key has a TTL, and publishes each
+	// tick's expirations in batches of up to publish_max_ops.
+	uint32_t expiry_tick_ms;
+	// How long a master may hold off telling cloners that replicate only
+	// some keys about updates to other keys, which they need just for
+	// their sequence, so that a run of them costs one small heartbeat.
+	// Zero sends one for every run published.
+	uint32_t filter_heartbeat_ms;
+};
 
+void aclone_master_config_init(aclone_master_config* config);
+
+aclone_store* aclone_store_open_master_config(aclone_context* ctx,
+                                              const char* topic, int flags,
+                                              const aclone_master_config* config);
+
+// Any number of masters may be published on the same addr and port: remote
+// and cloner handles pick theirs by topic, and all of a context's handles
+// share one connection to each peer.
 int aclone_store_publish_master(aclone_context* ctx, aclone_store* master,
                                 const char* addr, uint16_t port);
 
@@ -52,6 +155,76 @@ aclone_store* aclone_store_open_cloner(aclone_context* ctx, const char* topic,
                                        const char* addr, uint16_t port,
                                        int flags);
 
+// Flags for opening a cloner.
+enum aclone_cloner_flags {
+    // Keep a copy of the store on disk to warm start from.  See persist_dir.
+    ACLONE_CLONER_PERSISTENT = 0x1,
+};
+
+// The keys from 'first' up to, but not including, 'last', or every key from
+// 'first' on if 'last' is empty.
+struct aclone_key_range {
+	aclone_key first;
+	aclone_key last;
+};
+
+struct aclone_cloner_config {
+	// Directory a persistent cloner writes a memory-mappable copy of its
+	// store to, per shard, when closed and every persist_interval seconds
+	// (if non-zero).  Writing blocks the cloner's updates meanwhile.  When
+	// it is next opened, reads are served from the mapped copy right away
+	// while it loads, and the master is only asked for updates since,
+	// unless it no longer has them in its replay log.  Reads keep seeing
+	// the old copy until the cloner has caught up.
+	const char* persist_dir;
+	uint32_t persist_interval;
+	// ACLONE_SNAPSHOT_* codecs offered to the master for snapshots.
+	uint32_t snapshot_codecs;
+	// Further "addr:port" endpoints, comma-separated, that the topic is
+	// published on by its master or by relays.  When the one a cloner
+	// replicates from goes away, or is a relay that has stopped relaying
+	// or is full, it moves on to the next, going back to the one it was
+	// opened with after the last, and replays just the updates it missed
+	// if the new one still has them.
+	const char* failover;
+	// Once the cloner is published as a relay: the number of relayed
+	// updates it retains for downstream cloners to replay, the size of the
+	// snapshot chunks it streams them (as with a master), and the most
+	// downstream cloners it takes on (zero for no limit).
+	size_t relay_log_size;
+	size_t relay_chunk_bytes;
+	size_t relay_max_subscribers;
+	// If any are given, only keys starting with one of key_prefixes or
+	// within one of key_ranges are replicated, rather than the whole topic:
+	// the master sends just their part of the snapshot and their updates,
+	// along with the sequence numbers of those it leaves out.  Reads find
+	// no other keys.  Relays only take on downstream cloners replicating
+	// the same keys, and a persistent cloner's files are named after them.
+	// A range with no keys in it makes opening the cloner fail, logging
+	// which one it was.
+	const aclone_key* key_prefixes;
+	size_t key_prefix_count;
+	const aclone_key_range* key_ranges;
+	size_t key_range_count;
+};
+
+void aclone_cloner_config_init(aclone_cloner_config* config);
+
+aclone_store* aclone_store_open_cloner_config(aclone_context* ctx,
+                                              const char* topic,
+                                              const char* addr, uint16_t port,
+                                              int flags,
+                                              const aclone_cloner_config* config);
+
+// Publishes a cloner as a relay, which other cloners open on its addr and
+// port just as they would its master.  A relay re-publishes the updates it
+// applies to them, so that cloners can be arranged in a tree in which no
+// store sends to more than a few subscribers.  Whenever the relay itself
+// loses its place in its master's history, it detaches its subscribers so
+// that they fail over.
+int aclone_store_publish_relay(aclone_context* ctx, aclone_store* cloner,
+                               const char* addr, uint16_t port);
+
 int aclone_store_close(aclone_context* ctx, aclone_store* store);
 
 // Store Updates
@@ -64,13 +237,60 @@ int aclone_store_insert(aclone_context* ctx, aclone_store* store,
 int aclone_store_remove(aclone_context* ctx, aclone_store* store,
                         aclone_key key);
 
+// Inserts a key that its master removes once 'ttl' seconds (which must be
+// positive) have passed, replicating that to cloners as an expiration.
+// Inserting or removing the key again drops its TTL; incrementing it
+// doesn't.  TTLs are only kept in memory: a durable master recovers keys
+// that had one without it.
+int aclone_store_insert_ttl(aclone_context* ctx, aclone_store* store,
+                            aclone_key key, aclone_val val, double ttl);
+
+// 'by' must be an 8-byte integer (0 is returned otherwise), and only
+// values that are themselves 8-byte integers are changed.
 int aclone_store_increment(aclone_context* ctx, aclone_store* store,
                            aclone_key key, aclone_val by);
 
 int aclone_store_decrement(aclone_context* ctx, aclone_store* store,
                            aclone_key key, aclone_val by);
 
+// Batched Updates
+//
+// A batch is applied by the master atomically under a contiguous range of
+// sequence numbers and replicated to cloners as a single message.  For a
+// sharded master, that holds separately for the ops on each shard's keys;
+// clears apply to every shard.
+
+struct aclone_batch;
+
+aclone_batch* aclone_batch_create(void);
+
+void aclone_batch_destroy(aclone_batch* batch);
+
+// Discards all operations added so far so the batch can be reused.
+void aclone_batch_reset(aclone_batch* batch);
+
+size_t aclone_batch_size(const aclone_batch* batch);
+
+int aclone_batch_clear(aclone_batch* batch);
+
+int aclone_batch_insert(aclone_batch* batch, aclone_key key, aclone_val val);
+
+int aclone_batch_remove(aclone_batch* batch, aclone_key key);
+
+int aclone_batch_increment(aclone_batch* batch, aclone_key key,
+                           aclone_val by);
+
+int aclone_batch_decrement(aclone_batch* batch, aclone_key key,
+                           aclone_val by);
+
+int aclone_store_apply_batch(aclone_context* ctx, aclone_store* store,
+                             const aclone_batch* batch);
+
 // Store Queries
+//
+// On cloner stores, the sync variants of lookup, haskey and size read the
+// local replica directly from the calling thread, without messaging the
+// cloner, whenever it is synchronized with its master.
 
 enum aclone_async_result {
     ACLONE_ASYNC_SUCCESS,
@@ -98,6 +318,40 @@ int aclone_store_haskey_async(aclone_context* ctx, aclone_store* store,
                               aclone_key key, double timeout,
                               aclone_haskey_cb callback, void* cookie);
 
+// Multi-key variants resolve all n keys with a single request.  Results are
+// parallel to the keys array, which an async request does not copy: it must
+// stay valid until the callback runs.  As with single lookups, values of
+// missing keys have a null val, and other values are malloc'd for the sync
+// caller to free but owned by the library during an async callback.
+
+int aclone_store_lookup_multi_sync(aclone_context* ctx, aclone_store* store,
+                                   const aclone_key* keys, size_t n,
+                                   aclone_val* results);
+
+typedef void (*aclone_lookup_multi_cb)(aclone_async_result result,
+                                       void* cookie, const aclone_key* keys,
+                                       const aclone_val* vals, size_t n);
+
+int aclone_store_lookup_multi_async(aclone_context* ctx, aclone_store* store,
+                                    const aclone_key* keys, size_t n,
+                                    double timeout,
+                                    aclone_lookup_multi_cb callback,
+                                    void* cookie);
+
+int aclone_store_haskey_multi_sync(aclone_context* ctx, aclone_store* store,
+                                   const aclone_key* keys, size_t n,
+                                   int* results);
+
+typedef void (*aclone_haskey_multi_cb)(aclone_async_result result,
+                                       void* cookie, const aclone_key* keys,
+                                       const int* exists, size_t n);
+
+int aclone_store_haskey_multi_async(aclone_context* ctx, aclone_store* store,
+                                    const aclone_key* keys, size_t n,
+                                    double timeout,
+                                    aclone_haskey_multi_cb callback,
+                                    void* cookie);
+
 int aclone_store_size_sync(aclone_context* ctx, aclone_store* store,
                            uint64_t* result);
 
@@ -108,7 +362,157 @@ int aclone_store_size_async(aclone_context* ctx, aclone_store* store,
                             double timeout, aclone_size_cb callback,
                             void* cookie);
 
-// TODO: aclone_store_get_keys_{sync,async}
+// Read-Modify-Writes
+//
+// Applied atomically by the key's master, which answers with the outcome
+// and publishes any change to cloners like any other update.  Cloner stores
+// pass these on to their master rather than answering from the replica.
+
+// Adds 'by' to a key, like aclone_store_increment(), and sets 'previous' to
+// the value it had before (zero, if missing).  Nothing is changed, and 0 is
+// returned, unless both 'by' and the key's value are 8-byte integers.
+int aclone_store_fetch_add_sync(aclone_context* ctx, aclone_store* store,
+                                aclone_key key, aclone_val by,
+                                int64_t* previous);
+
+typedef void (*aclone_fetch_add_cb)(aclone_async_result result, void* cookie,
+                                    aclone_key key, int64_t previous);
+
+int aclone_store_fetch_add_async(aclone_context* ctx, aclone_store* store,
+                                 aclone_key key, aclone_val by,
+                                 double timeout,
+                                 aclone_fetch_add_cb callback, void* cookie);
+
+// Inserts 'desired' if the key's value equals 'expected', or, when expected
+// has a null val, if the key is missing.  'swapped' is set to whether it
+// did, and 'previous' (unless null) to the value the key had, which is null
+// if it was missing and otherwise malloc'd for the caller to free, as with
+// lookups.  An async callback's previous value is owned by the library.
+int aclone_store_cas_sync(aclone_context* ctx, aclone_store* store,
+                          aclone_key key, aclone_val expected,
+                          aclone_val desired, int* swapped,
+                          aclone_val* previous);
+
+typedef void (*aclone_cas_cb)(aclone_async_result result, void* cookie,
+                              aclone_key key, int swapped,
+                              aclone_val previous);
+
+int aclone_store_cas_async(aclone_context* ctx, aclone_store* store,
+                           aclone_key key, aclone_val expected,
+                           aclone_val desired, double timeout,
+                           aclone_cas_cb callback, void* cookie);
+
+// Key Enumeration
+//
+// A cursor walks a store's keys in order, optionally only those starting
+// with a prefix, fetching one bounded page per request so that a scan of a
+// large store never occupies the store's actor for long.  Sharded stores
+// are scanned one shard after another, so keys are only ordered within
+// each shard.  Pages are not a
+// point-in-time snapshot: keys added or removed during the scan may or may
+// not be seen, but keys present throughout it are returned exactly once.
+
+struct aclone_cursor;
+
+// A page_size of zero picks a default.  Values are only fetched if
+// with_values is non-zero.
+aclone_cursor* aclone_cursor_open(aclone_context* ctx, aclone_store* store,
+                                  aclone_key prefix, size_t page_size,
+                                  int with_values);
+
+// Must not be called while an async page request is outstanding.
+void aclone_cursor_close(aclone_context* ctx, aclone_cursor* cursor);
+
+// Fetches the next page, setting n to the number of keys in it, or to zero
+// once the scan is complete.  The arrays are owned by the cursor and remain
+// valid until the next page is requested or the cursor is closed; vals is
+// null unless the cursor fetches values.
+int aclone_cursor_next_sync(aclone_context* ctx, aclone_cursor* cursor,
+                            const aclone_key** keys, const aclone_val** vals,
+                            size_t* n);
+
+typedef void (*aclone_cursor_cb)(aclone_async_result result, void* cookie,
+                                 aclone_cursor* cursor,
+                                 const aclone_key* keys,
+                                 const aclone_val* vals, size_t n);
+
+// At most one page may be requested at a time per cursor.
+int aclone_cursor_next_async(aclone_context* ctx, aclone_cursor* cursor,
+                             double timeout, aclone_cursor_cb callback,
+                             void* cookie);
+
+// Store Statistics
+
+#define ACLONE_LATENCY_BUCKETS 32
+
+struct aclone_histogram {
+	// buckets[i] counts samples that took [2^i, 2^(i+1)) nanoseconds.
+	uint64_t buckets[ACLONE_LATENCY_BUCKETS];
+};
+
+struct aclone_stats {
+	// Operations handled by the store's actor.
+	uint64_t inserts;
+	uint64_t increments;
+	uint64_t decrements;
+	uint64_t removes;
+	uint64_t clears;
+	uint64_t lookups;
+	uint64_t haskeys;
+	uint64_t sizes;
+	uint64_t fetch_adds;
+	uint64_t compare_swaps;
+	uint64_t snapshots;
+	uint64_t replays;
+	// Current contents and an estimate of the memory they occupy.
+	uint64_t keys;
+	uint64_t memory;
+	// Cloners subscribed to a master or relay.
+	uint64_t subscribers;
+	// Time a message currently waits in the actor's mailbox, and the number
+	// of messages that implies at the recent rate of handling them.
+	uint64_t mailbox_delay_ns;
+	uint64_t mailbox_depth;
+	// Time the actor spends applying and publishing each update.
+	aclone_histogram update_latency;
+	// Round trip time of synchronous requests made through this handle.
+	aclone_histogram request_latency;
+	// Coalesced batches a master has published, and their sizes in ops.
+	uint64_t publish_flushes;
+	aclone_histogram publish_batch_ops;
+	// Pages of keys served to cursors.
+	uint64_t key_pages;
+	// A durable master's log syncs (each committing a group of updates),
+	// bytes logged, and snapshots it started.
+	uint64_t wal_commits;
+	uint64_t wal_bytes;
+	uint64_t compactions;
+	// Key and value bytes of snapshot chunks a master or relay sent or a
+	// cloner received, the bytes they took encoded (snapshot_bytes divided by
+	// snapshot_wire_bytes being the compression ratio), and the CPU time
+	// spent encoding or decoding them.
+	uint64_t snapshot_bytes;
+	uint64_t snapshot_wire_bytes;
+	uint64_t snapshot_codec_ns;
+	// Keys a master expired, or a cloner removed for having expired, and
+	// the keys a master currently has a TTL for.
+	uint64_t expirations;
+	uint64_t ttl_keys;
+	// Updates a master left out of the streams of cloners replicating only
+	// some keys (counting each cloner's separately), or that such a cloner
+	// was told it skipped.
+	uint64_t filtered_updates;
+};
+
+// Reads the counters without messaging the store's actor.  Remote stores
+// have no local actor and only report request_latency.
+int aclone_store_stats(aclone_context* ctx, aclone_store* store,
+                       aclone_stats* stats);
+
+// Debugging
+
+// Prints the full contents of a master or cloner store.
+int aclone_store_dump(aclone_context* ctx, aclone_store* store);
 
 #ifdef __cplusplus
 } // extern "C"
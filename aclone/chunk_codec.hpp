@@ -0,0 +1,189 @@
+#ifndef ACLONE_CHUNK_CODEC_HPP
+#define ACLONE_CHUNK_CODEC_HPP
+
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+
+#include "aclone/aclone.h"
+#include "snapshot.hpp"
+#include "stats.hpp"
+#include "wire.hpp"
+#include "lz.hpp"
+
+namespace aclone {
+
+// A snapshot chunk as streamed to a cloner, encoded by the master with the
+// codecs (ACLONE_SNAPSHOT_* flags) negotiated for that cloner:
+//
+//   codecs     the flags actually applied, which decoding goes by
+//   body       sequence, last-chunk flag, entry count, then each entry's
+//              key and value; front coding replaces a key with the length
+//              it shares with the previous key and the rest of it
+//
+// With ACLONE_SNAPSHOT_LZ, the body is preceded by its size and compressed,
+// unless that wouldn't make it smaller.
+class packed_chunk {
+public:
+
+    packed_chunk() = default;
+
+    explicit packed_chunk(std::string arg_bytes)
+        : bytes(std::make_shared<const std::string>(std::move(arg_bytes)))
+        {}
+
+    // 'kv_bytes' gets the size of the keys and values encoded.
+    static packed_chunk encode(const kv_chunk& chunk, uint32_t codecs,
+                               uint64_t* kv_bytes)
+        {
+        bool front = codecs & ACLONE_SNAPSHOT_FRONT_CODING;
+        wire_writer body;
+        body.put_sequence(chunk.seq);
+        body.put_byte(chunk.last);
+        body.put_varint(chunk.entries.size());
+        const key_type* prev = nullptr;
+        *kv_bytes = 0;
+
+        for ( const auto& kv : chunk.entries )
+            {
+            const key_type& key = kv.first;
+            *kv_bytes += key.size() + kv.second.size();
+
+            if ( front )
+                {
+                size_t shared = prev ? common_prefix(*prev, key) : 0;
+                body.put_varint(shared);
+                body.put_bytes(key.data() + shared, key.size() - shared);
+                prev = &key;
+                }
+            else
+                body.put_bytes(key.data(), key.size());
+
+            body.put_bytes(kv.second.data(), kv.second.size());
+            }
+
+        const std::string& raw = body.buffer();
+        std::string out;
+        out.push_back(static_cast<char>(codecs & ACLONE_SNAPSHOT_FRONT_CODING));
+
+        if ( codecs & ACLONE_SNAPSHOT_LZ )
+            {
+            wire_writer header;
+            header.put_varint(raw.size());
+            std::string compressed = header.buffer();
+            lz_compress(raw.data(), raw.size(), &compressed);
+
+            if ( compressed.size() < raw.size() )
+                {
+                out[0] |= ACLONE_SNAPSHOT_LZ;
+                out += compressed;
+                return packed_chunk(std::move(out));
+                }
+            }
+
+        out += raw;
+        return packed_chunk(std::move(out));
+        }
+
+    // Throws std::runtime_error if malformed.
+    void decode(kv_chunk* chunk) const
+        {
+        wire_reader r(data(), size());
+        uint8_t codecs = r.get_byte();
+        std::string inflated;
+        const char* body = data() + 1;
+        size_t body_size = size() - 1;
+
+        if ( codecs & ~(ACLONE_SNAPSHOT_FRONT_CODING | ACLONE_SNAPSHOT_LZ) )
+            throw std::runtime_error("unknown snapshot codec");
+
+        if ( codecs & ACLONE_SNAPSHOT_LZ )
+            {
+            auto raw_size = r.get_varint();
+            size_t header = size() - 1 - r.remaining();
+            lz_decompress(body + header, body_size - header, raw_size,
+                          &inflated);
+            body = inflated.data();
+            body_size = inflated.size();
+            }
+
+        wire_reader br(body, body_size);
+        chunk->seq = br.get_sequence();
+        chunk->last = br.get_byte();
+        chunk->entries.clear();
+        auto n = br.get_varint();
+        key_type key;
+
+        for ( uint64_t i = 0; i < n; ++i )
+            {
+            size_t shared = 0;
+
+            if ( codecs & ACLONE_SNAPSHOT_FRONT_CODING )
+                {
+                shared = br.get_varint();
+
+                if ( shared > key.size() )
+                    throw std::runtime_error("bad front-coded key");
+                }
+
+            size_t klen, vlen;
+            auto k = br.get_bytes(&klen);
+            key.resize(shared);
+            key.append(k, klen);
+            auto v = br.get_bytes(&vlen);
+            chunk->entries.emplace_hint(chunk->entries.end(), key,
+                                        val_type(v, vlen));
+            }
+
+        if ( ! br.done() )
+            throw std::runtime_error("trailing bytes in snapshot chunk");
+        }
+
+    const char* data() const
+        { return bytes ? bytes->data() : ""; }
+
+    size_t size() const
+        { return bytes ? bytes->size() : 0; }
+
+private:
+
+    static size_t common_prefix(const key_type& a, const key_type& b)
+        {
+        auto n = std::min(a.size(), b.size());
+        return std::mismatch(a.begin(), a.begin() + n, b.begin()).first -
+               a.begin();
+        }
+
+    std::shared_ptr<const std::string> bytes;
+};
+
+inline bool operator==(const packed_chunk& lhs, const packed_chunk& rhs)
+    {
+    return lhs.size() == rhs.size() &&
+           std::char_traits<char>::compare(lhs.data(), rhs.data(),
+                                           lhs.size()) == 0;
+    }
+
+inline bool operator!=(const packed_chunk& lhs, const packed_chunk& rhs)
+    { return ! operator==(lhs, rhs); }
+
+// Encodes a chunk a store streams to a subscriber, counting what that took
+// and saved.
+inline packed_chunk pack_chunk(const kv_chunk& chunk, uint32_t codecs,
+                               store_stats& stats)
+    {
+    uint64_t kv_bytes;
+    auto start = thread_cpu_ns();
+    auto rval = packed_chunk::encode(chunk, codecs, &kv_bytes);
+    counter_add(stats.snapshot_codec_ns, thread_cpu_ns() - start);
+    counter_add(stats.snapshot_bytes, kv_bytes);
+    counter_add(stats.snapshot_wire_bytes, rval.size());
+    return rval;
+    }
+
+} // namespace aclone
+
+#endif // ACLONE_CHUNK_CODEC_HPP
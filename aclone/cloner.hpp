@@ -5,10 +5,25 @@
 #include <string>
 #include <sstream>
 #include <iostream>
+#include <memory>
+#include <vector>
+#include <unordered_map>
 
 #include <cppa/cppa.hpp>
 
+#include "aclone/aclone.h"
 #include "kv_store.hpp"
+#include "snapshot.hpp"
+#include "replay_log.hpp"
+#include "stats.hpp"
+#include "queries.hpp"
+#include "sharding.hpp"
+#include "peers.hpp"
+#include "replica.hpp"
+#include "store_file.hpp"
+#include "wire.hpp"
+#include "chunk_codec.hpp"
+#include "key_filter.hpp"
 
 namespace aclone {
 
@@ -17,178 +32,326 @@ friend class cppa::sb_actor<cloner>;
 
 public:
 
-    cloner(const std::string& addr, uint16_t port)
+    // 'arg_parents' are the endpoints the topic is published on, by its
+    // master or by relays, in the order they're tried.  Only the keys
+    // passing 'arg_filter' are replicated.
+    cloner(std::vector<endpoint> arg_parents, const std::string& topic,
+           size_t arg_shard, size_t arg_shards,
+           std::shared_ptr<peer_cache> arg_peers,
+           std::shared_ptr<store_stats> shared_stats,
+           std::shared_ptr<replica> arg_local,
+           const aclone_cloner_config& config, kv_filter arg_filter,
+           std::string arg_persist_path = "",
+           std::shared_ptr<const store_file> arg_warm_file = nullptr)
+        : parents(std::move(arg_parents)), shard(arg_shard),
+          shard_count(arg_shards), peers(std::move(arg_peers)),
+          stats(std::move(shared_stats)), local(std::move(arg_local)),
+          filter(std::move(arg_filter)), codecs(config.snapshot_codecs),
+          log(config.relay_log_size),
+          chunk_bytes(config.relay_chunk_bytes),
+          max_subscribers(config.relay_max_subscribers),
+          persist_path(std::move(arg_persist_path)),
+          persist_interval(config.persist_interval),
+          warm_file(std::move(arg_warm_file))
         {
         using namespace cppa;
 
+        queries = (
+        on(atom("lookup"), arg_match) >> [=](key_type& key)
+            {
+            return lookup_response(store, *stats, key);
+            },
+        on(atom("haskey"), arg_match) >> [=](key_type& key)
+            {
+            return haskey_response(store, *stats, key);
+            },
+        on(atom("lookup_multi"), arg_match) >> [=](kv_keys& keys)
+            {
+            return lookup_multi_response(store, *stats, keys);
+            },
+        on(atom("haskey_multi"), arg_match) >> [=](kv_keys& keys)
+            {
+            return haskey_multi_response(store, *stats, keys);
+            },
+        on(atom("keys"), arg_match) >> [=](key_type& prefix, key_type& after,
+                                           bool resume, uint64_t limit,
+                                           bool with_values)
+            {
+            return keys_response(store, *stats, prefix, after, resume, limit,
+                                 with_values);
+            },
+        on(atom("size")) >> [=]()
+            {
+            return size_response(store, *stats);
+            }
+        );
         bootstrap = (
         after(std::chrono::seconds(0)) >> [=]()
             {
+            if ( warm_file )
+                warm_start();
+
+            if ( persist_interval )
+                delayed_send(this, std::chrono::seconds(persist_interval),
+                             atom("persist"));
+
             reconnect();
             }
         );
         synchronizing = (
         on(atom("sync")) >> [=]()
             {
-            sync_send(master, atom("snapshot"), this).then(
-                on_arg_match >> [=](kv_store& sto)
-                    {
-                    store = sto;
-                    become(synchronized);
-                    aout(this) << "INFO: " << idstr() << " sync'd."
-                               << std::endl;
-                    },
-                on(atom("quit")) >> [=]()
-                    {
-                    quit();
-                    },
-                on_arg_match >> [=](down_msg& d)
-                    {
-                    aout(this) << "WARN: lost connection to kv_master"
-                               << std::endl;
-                    demonitor(master);
-                    master = invalid_actor;
-                    reconnect();
-                    }
-            );
+            if ( epoch )
+                request_replay();
+            else
+                request_snapshot();
+            }
+        );
+        loading = (
+        on(atom("quit")) >> [=]()
+            {
+            persist();
+            quit();
+            },
+        on(atom("probe"), arg_match) >> [=](int64_t due)
+            {
+            probed(due);
+            },
+        on(atom("chunk"), arg_match) >> [=](uint64_t id, packed_chunk& packed)
+            {
+            // Leftover from a stream that was abandoned for a newer one.
+            if ( id != loader.stream )
+                return;
+
+            kv_chunk chunk;
+
+            if ( ! unpack(packed, &chunk) )
+                return;
+
+            loader.add(chunk);
+
+            if ( ! chunk.last )
+                return;
+
+            if ( ! loader.finish(store) )
+                {
+                out_of_sync();
+                return;
+                }
+
+            epoch = loader.epoch;
+            warm = false;
+            failures = 0;
+            counter_set(stats->keys, store.store.size());
+            counter_set(stats->memory, store.memory_usage());
+            local->reset(store);
+            local->set_ready(true);
+            become(synchronized);
+            aout(this) << "INFO: " << idstr() << " sync'd." << std::endl;
+            },
+        // Updates published while the snapshot streams in.
+        on(atom("packed"), arg_match) >> [=](kv_packed& packed)
+            {
+            kv_batch ops;
+            kv_sequence seq;
+
+            if ( ! unpack(packed, &seq, &ops) )
+                return;
+
+            for ( auto& u : ops )
+                seq = loader.defer(seq, std::move(u));
+            },
+        on(atom("detach")) >> [=]()
+            {
+            detached();
+            },
+        on_arg_match >> [=](down_msg& d)
+            {
+            down(last_sender());
             }
         );
         disconnected = (
         on(atom("quit")) >> [=]()
             {
+            persist();
             quit();
             },
+        on(atom("probe"), arg_match) >> [=](int64_t due)
+            {
+            probed(due);
+            },
+        on(atom("persist")) >> [=]()
+            {
+            persist_periodically();
+            },
         on(atom("reconnect")) >> [=]()
             {
-            if ( try_connect(addr, port) )
-                synchronize();
+            if ( try_connect() )
+                resolve_shard(topic);
             else
-                reconnect();
+                failover();
             }
         );
         synchronized = (
         on(atom("quit")) >> [=]()
             {
+            persist();
             quit();
             },
+        on(atom("probe"), arg_match) >> [=](int64_t due)
+            {
+            probed(due);
+            },
+        on(atom("persist")) >> [=]()
+            {
+            persist_periodically();
+            },
         // Update Messages
         on(atom("insert"), arg_match) >> [=](key_type& key, val_type& val)
             {
             forward_to(master);
             },
-        on(atom("insert"), arg_match) >> [=](kv_sequence& seq, key_type& key,
-                                             val_type& val)
+        on(atom("insert_ttl"), arg_match) >> [=](key_type& key, val_type& val,
+                                                 uint64_t ttl_ms)
             {
-            kv_sequence next = store.nextseq();
-
-            if ( seq == next )
-                {
-                store.update(key, val);
-                dbg_dump(this, idstr(), store);
-                }
-            else if ( seq > next )
-                out_of_sync();
+            forward_to(master);
             },
         on(atom("increment"), arg_match) >> [=](key_type& key, val_type& by)
             {
             forward_to(master);
             },
-        on(atom("increment"), arg_match) >> [=](kv_sequence& seq, key_type& key,
-                                                val_type& by)
+        on(atom("decrement"), arg_match) >> [=](key_type& key, val_type& by)
             {
-            kv_sequence next = store.nextseq();
-
-            if ( seq == next )
-                {
-                store.update(key, store.store[key] + by);
-                dbg_dump(this, idstr(), store);
-                }
-            else if ( seq > next )
-                out_of_sync();
+            forward_to(master);
             },
-        on(atom("decrement"), arg_match) >> [=](key_type& key, val_type& by)
+        on(atom("remove"), arg_match) >> [=](key_type& key)
             {
             forward_to(master);
             },
-        on(atom("decrement"), arg_match) >> [=](kv_sequence& seq, key_type& key,
-                                                val_type& by)
+        on(atom("clear"), arg_match) >> [=]()
             {
-            kv_sequence next = store.nextseq();
-
-            if ( seq == next )
-                {
-                store.update(key, store.store[key] - by);
-                dbg_dump(this, idstr(), store);
-                }
-            else if ( seq > next )
-                out_of_sync();
+            forward_to(master);
             },
-        on(atom("remove"), arg_match) >> [=](key_type& key)
+        on(atom("batch"), arg_match) >> [=](kv_batch& ops)
             {
             forward_to(master);
             },
-        on(atom("remove"), arg_match) >> [=](kv_sequence& seq, key_type& key)
+        on(atom("packed"), arg_match) >> [=](kv_packed& packed)
             {
-            kv_sequence next = store.nextseq();
+            kv_batch ops;
+            kv_sequence first;
 
-            if ( seq == next )
-                {
-                store.remove(key);
-                dbg_dump(this, idstr(), store);
-                }
-            else if ( seq > next )
-                out_of_sync();
+            if ( unpack(packed, &first, &ops) && received(first, ops) )
+                relay(first, packed);
             },
-        on(atom("clear"), arg_match) >> [=]()
+        on(atom("detach")) >> [=]()
             {
-            forward_to(master);
+            detached();
             },
-        on(atom("clear"), arg_match) >> [=](kv_sequence& seq)
+        // Relaying to downstream cloners, which subscribe just as they would
+        // to a master.
+        on(atom("relay")) >> [=]()
             {
-            kv_sequence next = store.nextseq();
+            relaying = true;
+            },
+        on(atom("snapshot"), arg_match) >> [=](actor& sender,
+                                               uint32_t offered,
+                                               kv_filter& keys) -> any_tuple
+            {
+            auto sender_addr = last_sender();
 
-            if ( seq == next )
-                {
-                store.clear();
-                dbg_dump(this, idstr(), store);
-                }
-            else if ( seq > next )
-                out_of_sync();
+            if ( keys != filter || ! subscribe(sender_addr, sender) )
+                return make_cow_tuple(atom("busy"));
+
+            counter_add(stats->snapshots);
+            auto& s = streams[sender_addr];
+            ++s.id;
+            s.codecs = offered & codecs;
+            send(this, atom("stream"), sender, s.id, false, key_type{});
+            return make_cow_tuple(atom("snapshot"), epoch, store.sequence, s.id,
+                                  s.codecs);
+            },
+        on(atom("stream"), arg_match) >> [=](actor& dst, uint64_t id,
+                                             bool resume, key_type& after)
+            {
+            auto it = streams.find(dst.address());
+
+            if ( it == streams.end() || it->second.id != id )
+                return;
+
+            auto chunk = cut_chunk(store, resume, after, chunk_bytes);
+            auto packed = pack_chunk(chunk, it->second.codecs, *stats);
+
+            if ( ! chunk.last )
+                send(this, atom("stream"), dst, id, true,
+                     chunk.entries.rbegin()->first);
+            else
+                streams.erase(it);
+
+            send(dst, atom("chunk"), id, std::move(packed));
+            },
+        on(atom("replay"), arg_match) >> [=](uint64_t sender_epoch,
+                                             kv_sequence& since, actor& sender,
+                                             kv_filter& keys) -> any_tuple
+            {
+            if ( sender_epoch != epoch || ! log.covers(since, store.sequence) )
+                return make_cow_tuple(atom("stale"));
+
+            if ( keys != filter || ! subscribe(last_sender(), sender) )
+                return make_cow_tuple(atom("busy"));
+
+            counter_add(stats->replays);
+            log.replay(since, [&](const any_tuple& msg)
+                { send_tuple(sender, msg); });
+            return make_cow_tuple(atom("replayed"));
             },
         // Request Messages
-        on(atom("lookup"), arg_match) >> [=](key_type& key)
+        on(atom("request"), arg_match) >> [=](uint64_t id, actor& reply_to,
+                                              any_tuple& query)
             {
-            auto it = store.store.find(key);
-            if ( it == store.store.end() )
-                return make_cow_tuple(atom("null"), static_cast<val_type>(0));
+            // The master answers those itself, straight to the requester.
+            if ( is_update_query(query) )
+                forward_to(master);
             else
-                return make_cow_tuple(atom("ok"), it->second);
+                send(reply_to, atom("response"), id,
+                     query_result(queries, query));
+            },
+        on(atom("lookup"), arg_match) >> [=](key_type& key)
+            {
+            return lookup_response(store, *stats, key);
             },
         on(atom("haskey"), arg_match) >> [=](key_type& key)
             {
-            return make_cow_tuple(store.store.find(key) != store.store.end());
+            return haskey_response(store, *stats, key);
             },
         on(atom("size")) >> [=]()
             {
-            return make_cow_tuple(static_cast<uint64_t>(store.store.size()));
+            return size_response(store, *stats);
+            },
+        on(atom("dump")) >> [=]()
+            {
+            dbg_dump(this, idstr(), store);
             },
         on_arg_match >> [=](down_msg& d)
             {
-            aout(this) << "WARN: lost connection to kv_master" << std::endl;
-            demonitor(master);
-            master = invalid_actor;
-            reconnect();
+            down(last_sender());
             }
         );
         }
 
 private:
 
-    bool try_connect(const std::string& addr, uint16_t port)
+    bool try_connect()
         {
+        const auto& addr = parents[parent].first;
+        auto port = parents[parent].second;
+
         try
             {
-            master = cppa::remote_actor(addr, port);
+            // The published front-end, which resolve_shard() exchanges for
+            // the master (or relay) of this cloner's topic and shard.
+            master = peers->connect(addr, port);
+            entry = master;
             monitor(master);
             aout(this) << "INFO: connected to kv_master: " << addr << ":"
                        << port << std::endl;
@@ -211,6 +374,62 @@ private:
         delayed_send(this, std::chrono::seconds(3), atom("reconnect"));
         }
 
+    // Moves on to the next endpoint the topic is published on, right away
+    // unless every one has failed since this cloner was last synchronized.
+    void failover()
+        {
+        using namespace cppa;
+        parent = (parent + 1) % parents.size();
+
+        if ( ++failures % parents.size() == 0 )
+            {
+            reconnect();
+            return;
+            }
+
+        aout(this) << "INFO: " << idstr() << " failing over to "
+                   << parents[parent].first << ":" << parents[parent].second
+                   << std::endl;
+        become(disconnected);
+        send(this, atom("reconnect"));
+        }
+
+    void resolve_shard(const std::string& topic)
+        {
+        using namespace cppa;
+        become(synchronizing);
+        sync_send(master, atom("topology"), topic).then(
+            on(atom("topology"), arg_match) >> [=](kv_shards& shards)
+                {
+                if ( shards.size() != shard_count )
+                    {
+                    aout(this) << "ERROR: " << idstr() << " expected "
+                               << shard_count << " shards of '" << topic
+                               << "', master has " << shards.size()
+                               << std::endl;
+                    demonitor(master);
+                    master = invalid_actor;
+                    failover();
+                    return;
+                    }
+
+                demonitor(master);
+                master = shards[shard];
+                monitor(master);
+
+                synchronize();
+                },
+            on(atom("quit")) >> [=]()
+                {
+                quit();
+                },
+            on_arg_match >> [=](down_msg& d)
+                {
+                lost_master();
+                }
+        );
+        }
+
     void synchronize()
         {
         using namespace cppa;
@@ -218,25 +437,388 @@ private:
         send(this, atom("sync"));
         }
 
+    void request_snapshot()
+        {
+        using namespace cppa;
+        sync_send(master, atom("snapshot"), this, codecs, filter).then(
+            on(atom("snapshot"), arg_match) >> [=](uint64_t master_epoch,
+                                                   kv_sequence& seq,
+                                                   uint64_t stream,
+                                                   uint32_t used)
+                {
+                loader.start(master_epoch, seq, stream);
+                become(loading);
+
+                if ( used )
+                    aout(this) << "INFO: " << idstr() << " loading snapshot"
+                               << " with codecs 0x" << std::hex << used
+                               << std::dec << std::endl;
+                },
+            on(atom("busy")) >> [=]()
+                {
+                refused();
+                },
+            on(atom("quit")) >> [=]()
+                {
+                quit();
+                },
+            on_arg_match >> [=](down_msg& d)
+                {
+                lost_master();
+                }
+        );
+        }
+
+    void request_replay()
+        {
+        using namespace cppa;
+        sync_send(master, atom("replay"), epoch, store.sequence, this,
+                  filter).then(
+            on(atom("replayed")) >> [=]()
+                {
+                warm = false;
+                failures = 0;
+                local->set_ready(true);
+                become(synchronized);
+                aout(this) << "INFO: " << idstr() << " sync'd from replay log."
+                           << std::endl;
+                },
+            on(atom("stale")) >> [=]()
+                {
+                request_snapshot();
+                },
+            on(atom("busy")) >> [=]()
+                {
+                refused();
+                },
+            on(atom("quit")) >> [=]()
+                {
+                quit();
+                },
+            on_arg_match >> [=](down_msg& d)
+                {
+                lost_master();
+                }
+        );
+        }
+
+    void lost_master()
+        {
+        aout(this) << "WARN: lost connection to kv_master" << std::endl;
+        // Whatever failed, the next attempt starts from a fresh connection.
+        peers->drop(parents[parent].first, parents[parent].second, entry);
+        leave_parent();
+        }
+
+    // The relay this cloner replicates from stopped relaying.
+    void detached()
+        {
+        if ( last_sender() != master.address() )
+            return;
+
+        aout(this) << "WARN: " << idstr() << " detached by its relay"
+                   << std::endl;
+        leave_parent();
+        }
+
+    // The relay this cloner subscribed to has no room for it, or replicates
+    // other keys than it does.
+    void refused()
+        {
+        aout(this) << "WARN: " << idstr() << " refused by a relay"
+                   << std::endl;
+        leave_parent();
+        }
+
+    void leave_parent()
+        {
+        using namespace cppa;
+
+        if ( ! warm )
+            local->set_ready(false);
+
+        detach();
+        demonitor(master);
+        master = invalid_actor;
+        entry = invalid_actor;
+        failover();
+        }
+
+    void down(const cppa::actor_addr& who)
+        {
+        if ( who == master.address() )
+            {
+            lost_master();
+            return;
+            }
+
+        // A downstream cloner went away.
+        demonitor(who);
+        subscribers.erase(who);
+        streams.erase(who);
+        counter_set(stats->subscribers, subscribers.size());
+        }
+
+    // Subscribes a downstream cloner to the updates this one applies, unless
+    // that would take more than max_subscribers.
+    bool subscribe(const cppa::actor_addr& addr, const cppa::actor& sender)
+        {
+        if ( subscribers.find(addr) != subscribers.end() )
+            return true;
+
+        if ( max_subscribers && subscribers.size() >= max_subscribers )
+            return false;
+
+        monitor(addr);
+        subscribers[addr] = sender;
+        counter_set(stats->subscribers, subscribers.size());
+        return true;
+        }
+
+    // Passes a run of updates this cloner just applied on to downstream
+    // cloners, exactly as it was received.
+    void relay(const kv_sequence& first, const kv_packed& packed)
+        {
+        using namespace cppa;
+
+        if ( ! relaying )
+            return;
+
+        any_tuple msg = make_cow_tuple(atom("packed"), packed);
+        log.append(first, msg);
+
+        for ( const auto& s : subscribers )
+            send_tuple(s.second, msg);
+        }
+
+    // Tells downstream cloners to find another parent, as this one no longer
+    // has the history they were following.
+    void detach()
+        {
+        using namespace cppa;
+
+        for ( const auto& s : subscribers )
+            {
+            send(s.second, atom("detach"));
+            demonitor(s.first);
+            }
+
+        subscribers.clear();
+        streams.clear();
+        log.clear();
+        counter_set(stats->subscribers, 0);
+        }
+
+    // Decodes a snapshot chunk, counting the bytes and CPU time that took.
+    // One that doesn't decode restarts the snapshot.
+    bool unpack(const packed_chunk& packed, kv_chunk* chunk)
+        {
+        auto start = thread_cpu_ns();
+
+        try
+            {
+            packed.decode(chunk);
+            }
+        catch ( std::exception& e )
+            {
+            aout(this) << "ERROR: " << idstr() << " bad snapshot chunk: "
+                       << e.what() << std::endl;
+            out_of_sync();
+            return false;
+            }
+
+        counter_add(stats->snapshot_codec_ns, thread_cpu_ns() - start);
+        counter_add(stats->snapshot_wire_bytes, packed.size());
+
+        for ( const auto& kv : chunk->entries )
+            counter_add(stats->snapshot_bytes,
+                        kv.first.size() + kv.second.size());
+
+        return true;
+        }
+
+    // Decodes a published run of updates.  One that doesn't decode leaves
+    // no way to tell what was missed, so that resynchronizes.
+    bool unpack(const kv_packed& packed, kv_sequence* first, kv_batch* ops)
+        {
+        try
+            {
+            *first = packed.decode(ops);
+            return true;
+            }
+        catch ( std::exception& e )
+            {
+            aout(this) << "ERROR: " << idstr() << " bad update message: "
+                       << e.what() << std::endl;
+            out_of_sync();
+            return false;
+            }
+        }
+
+    // Returns whether the updates were applied, rather than being ones
+    // already applied or a sign that some were missed.
+    bool received(const kv_sequence& first, const kv_batch& ops)
+        {
+        kv_sequence next = store.nextseq();
+
+        if ( first == next )
+            {
+            auto start = now_ns();
+
+            for ( const auto& u : ops )
+                {
+                store.apply(u);
+
+                if ( u.op == KV_OP_SKIP )
+                    {
+                    counter_add(stats->filtered_updates, sequences(u));
+                    continue;
+                    }
+
+                local->applied(u, store);
+                counter_add(stats->updates(u.op));
+                }
+
+            updated(start);
+            return true;
+            }
+        else if ( first > next )
+            out_of_sync();
+
+        return false;
+        }
+
+    // Takes over the store persisted by an earlier run, which the replica
+    // has been serving from the mapped file meanwhile.  Reads keep being
+    // served from it until the master brings it up to date, by replaying
+    // just the updates since its sequence if it still has them.
+    void warm_start()
+        {
+        auto f = std::move(warm_file);
+
+        if ( ! f->load(store) )
+            {
+            aout(this) << "WARN: " << idstr() << " ignoring corrupt "
+                       << persist_path << std::endl;
+            store = kv_store{};
+            local->set_ready(false);
+            local->reset(store);
+            return;
+            }
+
+        epoch = f->epoch();
+        warm = true;
+        counter_set(stats->keys, store.store.size());
+        counter_set(stats->memory, store.memory_usage());
+        local->reset(store);
+        aout(this) << "INFO: " << idstr() << " loaded " << store.store.size()
+                   << " keys from " << persist_path << std::endl;
+        }
+
+    // Writes the store out for the next run to start from.  This blocks
+    // the cloner for as long as writing the whole store takes.
+    void persist()
+        {
+        if ( persist_path.empty() || ! epoch )
+            return;
+
+        if ( ! store_file::write(persist_path, epoch, store, shard,
+                                 shard_count) )
+            aout(this) << "WARN: " << idstr() << " failed to write "
+                       << persist_path << std::endl;
+        }
+
+    void persist_periodically()
+        {
+        using namespace cppa;
+        persist();
+        delayed_send(this, std::chrono::seconds(persist_interval),
+                     atom("persist"));
+        }
+
+    void updated(int64_t start)
+        {
+        counter_set(stats->keys, store.store.size());
+        counter_set(stats->memory, store.memory_usage());
+        stats->update_latency.record(now_ns() - start);
+        }
+
+    void probed(int64_t due)
+        {
+        using namespace cppa;
+        stats->probed(due);
+        auto next = now_ns() + probe_interval_ns;
+        delayed_send(this, std::chrono::nanoseconds(probe_interval_ns),
+                     atom("probe"), next);
+        }
+
     void out_of_sync()
         {
         // TODO: should never be able to get in to this state?
         aout(this) << "ERROR: " << idstr() << " out of sync." << std::endl;
+        local->set_ready(false);
+        detach();
         synchronize();
         }
 
     std::string idstr() const
         {
         std::stringstream ss;
-        ss << "cloner(" << this << ")";
+        ss << "cloner(" << this << ", shard " << shard << ")";
         return ss.str();
         }
 
+    // Epoch of the master history 'store' was synchronized from, or zero if
+    // this cloner has never synchronized.
+    uint64_t epoch = 0;
+    // Where the topic is published, the one currently replicated from, and
+    // how many have failed in a row.
+    std::vector<endpoint> parents;
+    size_t parent = 0;
+    size_t failures = 0;
+    // Which of the topic's shards this cloner replicates.
+    size_t shard;
+    size_t shard_count;
+    std::shared_ptr<peer_cache> peers;
     kv_store store;
+    snapshot_loader loader;
+    std::shared_ptr<store_stats> stats;
+    // Lock-free copy of 'store' that handles read from directly.
+    std::shared_ptr<replica> local;
+    // The keys replicated, which relays also require of their subscribers,
+    // as they pass on what they receive as it is.
+    kv_filter filter;
+    // ACLONE_SNAPSHOT_* codecs offered to the master, and accepted from
+    // downstream cloners when relaying.
+    uint32_t codecs;
+    // Downstream cloners subscribed to this one once it's published as a
+    // relay, the updates kept for them to replay, and their snapshots.
+    bool relaying = false;
+    replay_log log;
+    size_t chunk_bytes;
+    size_t max_subscribers;
+    std::unordered_map<cppa::actor_addr, cppa::actor> subscribers;
+    struct stream {
+        uint64_t id = 0;
+        uint32_t codecs = 0;
+    };
+
+    std::unordered_map<cppa::actor_addr, stream> streams;
+    // Where the store is persisted, if anywhere, and how often.
+    std::string persist_path;
+    uint32_t persist_interval;
+    // A store persisted by an earlier run, until loaded.
+    std::shared_ptr<const store_file> warm_file;
+    // Whether the store is one loaded from a file that the master hasn't
+    // brought up to date yet.
+    bool warm = false;
+    cppa::actor entry = cppa::invalid_actor;
     cppa::actor master = cppa::invalid_actor;
+    cppa::partial_function queries;
     cppa::behavior bootstrap;
     cppa::behavior disconnected;
     cppa::behavior synchronizing;
+    cppa::behavior loading;
     cppa::behavior synchronized;
     cppa::behavior& init_state = bootstrap;
 };
@@ -0,0 +1,115 @@
+#ifndef ACLONE_COMPLETION_QUEUE_HPP
+#define ACLONE_COMPLETION_QUEUE_HPP
+
+#include <deque>
+#include <cerrno>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include <stdexcept>
+#include <functional>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+namespace aclone {
+
+// Async completions waiting to be run on an application thread.  The eventfd
+// is readable whenever the queue is non-empty, so the queue can be watched
+// from an external event loop.
+class completion_queue {
+public:
+
+    using completion = std::function<void ()>;
+
+    completion_queue()
+        : fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+        {
+        if ( fd < 0 )
+            throw std::runtime_error("eventfd() failed");
+        }
+
+    ~completion_queue()
+        {
+        close(fd);
+        }
+
+    completion_queue(const completion_queue&) = delete;
+    completion_queue& operator=(const completion_queue&) = delete;
+
+    void push(completion c)
+        {
+        std::lock_guard<std::mutex> guard{mtx};
+        queue.push_back(std::move(c));
+
+        // Only the transition to non-empty needs to wake the poller.
+        if ( queue.size() == 1 )
+            signal();
+        }
+
+    // Runs up to 'max' queued completions on the calling thread.
+    size_t poll(size_t max)
+        {
+        std::vector<completion> batch;
+
+            {
+            std::lock_guard<std::mutex> guard{mtx};
+
+            while ( ! queue.empty() && batch.size() < max )
+                {
+                batch.push_back(std::move(queue.front()));
+                queue.pop_front();
+                }
+
+            if ( queue.empty() )
+                drain();
+            }
+
+        for ( auto& c : batch )
+            c();
+
+        return batch.size();
+        }
+
+    // Waits up to 'timeout' seconds (forever if negative) for a completion,
+    // then runs up to 'max' of them.
+    size_t wait(size_t max, double timeout)
+        {
+        pollfd pfd{fd, POLLIN, 0};
+        int ms = timeout < 0 ? -1 : static_cast<int>(timeout * 1000);
+
+        if ( ::poll(&pfd, 1, ms) <= 0 )
+            return 0;
+
+        return poll(max);
+        }
+
+    int descriptor() const
+        { return fd; }
+
+private:
+
+    void signal()
+        {
+        uint64_t one = 1;
+
+        while ( write(fd, &one, sizeof(one)) < 0 && errno == EINTR )
+            ;
+        }
+
+    void drain()
+        {
+        uint64_t count;
+
+        while ( read(fd, &count, sizeof(count)) < 0 && errno == EINTR )
+            ;
+        }
+
+    int fd;
+    std::mutex mtx;
+    std::deque<completion> queue;
+};
+
+} // namespace aclone
+
+#endif // ACLONE_COMPLETION_QUEUE_HPP
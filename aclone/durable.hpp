@@ -0,0 +1,715 @@
+#ifndef ACLONE_DURABLE_HPP
+#define ACLONE_DURABLE_HPP
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <cerrno>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <functional>
+#include <condition_variable>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "kv_store.hpp"
+#include "snapshot.hpp"
+#include "stats.hpp"
+#include "mapped_file.hpp"
+
+namespace aclone {
+
+inline uint32_t crc32(const char* data, size_t size)
+    {
+    static const struct table {
+        table()
+            {
+            for ( uint32_t i = 0; i < 256; ++i )
+                {
+                uint32_t c = i;
+
+                for ( int k = 0; k < 8; ++k )
+                    c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+
+                entries[i] = c;
+                }
+            }
+
+        uint32_t entries[256];
+    } t;
+
+    uint32_t c = 0xffffffff;
+
+    for ( size_t i = 0; i < size; ++i )
+        c = t.entries[(c ^ static_cast<uint8_t>(data[i])) & 0xff] ^ (c >> 8);
+
+    return c ^ 0xffffffff;
+    }
+
+// Builds a record for a durable master's files.  Fields are written in host
+// byte order, since the files are only read back by the host that wrote
+// them.  Each record is framed by its length and a checksum, so that one
+// torn by a crash is detected.
+class record_encoder {
+public:
+
+    template <typename T>
+    void put(T v)
+        { payload.append(reinterpret_cast<const char*>(&v), sizeof(v)); }
+
+    void put(const kv_sequence& seq)
+        {
+        put(seq.hi);
+        put(seq.lo);
+        }
+
+    void put_bytes(const char* data, size_t size)
+        {
+        put(static_cast<uint32_t>(size));
+        payload.append(data, size);
+        }
+
+    // Appends the framed record to 'out' and starts the next one.
+    void finish(std::string& out)
+        {
+        uint32_t len = payload.size();
+        uint32_t crc = crc32(payload.data(), payload.size());
+        out.append(reinterpret_cast<const char*>(&len), sizeof(len));
+        out.append(reinterpret_cast<const char*>(&crc), sizeof(crc));
+        out.append(payload);
+        payload.clear();
+        }
+
+private:
+
+    std::string payload;
+};
+
+class record_decoder {
+public:
+
+    record_decoder(const char* data, size_t size)
+        : p(data), end(data + size)
+        {}
+
+    // Moves to the next intact record, returning false at the end of the
+    // data or at a torn or corrupt record.
+    bool next()
+        {
+        uint32_t len, crc;
+
+        if ( end - p < 8 )
+            return false;
+
+        memcpy(&len, p, sizeof(len));
+        memcpy(&crc, p + 4, sizeof(crc));
+
+        if ( static_cast<size_t>(end - p - 8) < len ||
+             crc32(p + 8, len) != crc )
+            return false;
+
+        field = p + 8;
+        p = field + len;
+        return true;
+        }
+
+    template <typename T>
+    bool get(T* v)
+        {
+        if ( static_cast<size_t>(p - field) < sizeof(*v) )
+            return false;
+
+        memcpy(v, field, sizeof(*v));
+        field += sizeof(*v);
+        return true;
+        }
+
+    bool get(kv_sequence* seq)
+        { return get(&seq->hi) && get(&seq->lo); }
+
+    bool get_bytes(const char** data, size_t* size)
+        {
+        uint32_t n;
+
+        if ( ! get(&n) || static_cast<size_t>(p - field) < n )
+            return false;
+
+        *data = field;
+        *size = n;
+        field += n;
+        return true;
+        }
+
+private:
+
+    const char* p;
+    const char* end;
+    // Next unread field of the current record, which ends at 'p'.
+    const char* field = nullptr;
+};
+
+// Appends to a write-ahead log from a thread of its own, so the actor that
+// logs never waits for the disk.  Records appended while the previous write
+// is being synced are written and synced together: the group commit grows
+// with the update rate instead of taking one fsync per update.
+//
+// Once a write or sync fails, the log is broken: recovery stops at the torn
+// record, so nothing more is written after it, and failed() tells the
+// master to stop accepting updates it could only lose.
+class wal_writer {
+public:
+
+    wal_writer(int arg_fd, std::shared_ptr<store_stats> arg_stats)
+        : fd(arg_fd), stats(std::move(arg_stats)),
+          thread([this]() { run(); })
+        {}
+
+    // Writes and syncs whatever is still queued first.
+    ~wal_writer()
+        {
+            {
+            std::lock_guard<std::mutex> guard{mtx};
+            stopping = true;
+            }
+
+        ready.notify_one();
+        thread.join();
+        close(fd);
+        }
+
+    wal_writer(const wal_writer&) = delete;
+    wal_writer& operator=(const wal_writer&) = delete;
+
+    void append(const std::string& bytes)
+        {
+            {
+            std::lock_guard<std::mutex> guard{mtx};
+            open_step().bytes += bytes;
+            }
+
+        ready.notify_one();
+        }
+
+    // Runs 'job' on the writer's thread once everything appended before it
+    // has been synced.
+    void after_sync(std::function<void ()> job)
+        {
+            {
+            std::lock_guard<std::mutex> guard{mtx};
+            open_step().then = std::move(job);
+            }
+
+        ready.notify_one();
+        }
+
+    // Appends go to 'next_fd' from now on, once what's already been
+    // appended is synced.
+    void switch_to(int next_fd)
+        {
+        after_sync([this, next_fd]()
+            {
+            close(fd);
+            fd = next_fd;
+            });
+        }
+
+    bool failed() const
+        { return broken; }
+
+private:
+
+    struct step {
+        std::string bytes;
+        std::function<void ()> then;
+    };
+
+    step& open_step()
+        {
+        if ( queue.empty() || queue.back().then )
+            queue.emplace_back();
+
+        return queue.back();
+        }
+
+    void run()
+        {
+        for ( ; ; )
+            {
+            std::vector<step> steps;
+
+                {
+                std::unique_lock<std::mutex> lock{mtx};
+                ready.wait(lock, [this]()
+                    { return ! queue.empty() || stopping; });
+
+                if ( queue.empty() )
+                    return;
+
+                steps.swap(queue);
+                }
+
+            for ( size_t i = 0; i < steps.size(); ++i )
+                {
+                write_all(steps[i].bytes);
+
+                if ( steps[i].then || i == steps.size() - 1 )
+                    sync();
+
+                if ( steps[i].then )
+                    steps[i].then();
+                }
+            }
+        }
+
+    void write_all(const std::string& bytes)
+        {
+        if ( broken )
+            return;
+
+        const char* p = bytes.data();
+        size_t n = bytes.size();
+
+        while ( n )
+            {
+            auto rc = write(fd, p, n);
+
+            if ( rc < 0 && errno == EINTR )
+                continue;
+
+            if ( rc < 0 )
+                {
+                std::cerr << "ERROR: write-ahead log write failed: "
+                          << strerror(errno) << std::endl;
+                broken = true;
+                return;
+                }
+
+            p += rc;
+            n -= rc;
+            }
+
+        counter_add(stats->wal_bytes, bytes.size());
+        dirty = dirty || bytes.size();
+        }
+
+    void sync()
+        {
+        if ( ! dirty || broken )
+            return;
+
+        if ( fdatasync(fd) < 0 )
+            {
+            std::cerr << "ERROR: write-ahead log sync failed: "
+                      << strerror(errno) << std::endl;
+            broken = true;
+            return;
+            }
+
+        dirty = false;
+        counter_add(stats->wal_commits);
+        }
+
+    // Only touched by the writer's thread once it's running.
+    int fd;
+    bool dirty = false;
+    std::shared_ptr<store_stats> stats;
+    // Set by the writer's thread, read by the master's.
+    std::atomic<bool> broken{false};
+    std::mutex mtx;
+    std::condition_variable ready;
+    std::vector<step> queue;
+    bool stopping = false;
+    std::thread thread;
+};
+
+// The files that make one master's store durable, all named after it in
+// one directory: log segments '<name>.wal.<n>', each started when a
+// snapshot is, and the last complete snapshot '<name>.snapshot'.
+//
+// Snapshots are written in chunks between other updates, just like the ones
+// streamed to cloners, so compacting never stalls the master.  A snapshot
+// records the sequence it started at and the first log segment to replay
+// after it; recovery feeds both through a snapshot_loader, exactly as a
+// cloner assembles a streamed snapshot and the updates that raced it.
+class durable_log {
+public:
+
+    durable_log(std::string arg_dir, std::string arg_name,
+                size_t arg_compact_bytes,
+                std::shared_ptr<store_stats> shared_stats)
+        : dir(std::move(arg_dir)), name(std::move(arg_name)),
+          compact_bytes(arg_compact_bytes), stats(std::move(shared_stats))
+        {}
+
+    ~durable_log()
+        {
+        // An unfinished snapshot is discarded on the next recovery.
+        if ( snapshot_fd >= 0 )
+            close(snapshot_fd);
+        }
+
+    durable_log(const durable_log&) = delete;
+    durable_log& operator=(const durable_log&) = delete;
+
+    // Loads the last snapshot and the log after it, then starts a new log
+    // segment.  Throws if the files are unusable.
+    void recover()
+        {
+        if ( mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST )
+            throw std::runtime_error("can't create " + dir);
+
+        snapshot_loader loader;
+        kv_sequence start;
+        uint64_t first_segment = 0;
+        loader.start(0, start, 0);
+
+        if ( access(snapshot_path().c_str(), F_OK) == 0 )
+            load_snapshot(loader, &start, &first_segment);
+
+        auto segments = list_segments();
+
+        for ( auto n : segments )
+            {
+            if ( n < first_segment )
+                unlink(segment_path(n).c_str());
+            else
+                load_segment(n, loader, start);
+            }
+
+        unlink(snapshot_tmp_path().c_str());
+
+        if ( ! loader.finish(recovered) )
+            throw std::runtime_error("gap in write-ahead log of " + name);
+
+        segment = segments.empty() ? first_segment : segments.back() + 1;
+        writer.reset(new wal_writer(open_segment(segment), stats));
+        }
+
+    // Hands the recovered store over to its master.
+    void restore(kv_store& out)
+        {
+        out = std::move(recovered);
+        }
+
+    void append(const kv_sequence& seq, const kv_update& u)
+        {
+        enc.put(seq);
+        enc.put(u.op);
+        enc.put_bytes(u.key.data(), u.key.size());
+        enc.put_bytes(u.val.data(), u.val.size());
+        buf.clear();
+        enc.finish(buf);
+        log_bytes += buf.size();
+        writer->append(buf);
+        }
+
+    // Whether appends are being dropped, since the log couldn't be written.
+    bool failed() const
+        { return writer->failed(); }
+
+    bool compaction_due() const
+        {
+        return compact_bytes && snapshot_fd < 0 && log_bytes >= compact_bytes;
+        }
+
+    // Starts a snapshot of a store currently at sequence 'seq'; updates
+    // after it go to a new log segment.  Throws std::runtime_error if
+    // either file can't be written, and is then not snapshotting.
+    void begin_snapshot(const kv_sequence& seq)
+        {
+        writer->switch_to(open_segment(segment + 1));
+        ++segment;
+        log_bytes = 0;
+        counter_add(stats->compactions);
+
+        auto tmp = snapshot_tmp_path();
+        snapshot_fd = open(tmp.c_str(),
+                           O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+        if ( snapshot_fd < 0 )
+            throw std::runtime_error("can't create " + tmp + ": " +
+                                     strerror(errno));
+
+        enc.put(snapshot_magic);
+        enc.put(seq);
+        enc.put(segment);
+        buf.clear();
+        enc.finish(buf);
+        write_snapshot(buf);
+        }
+
+    bool snapshotting() const
+        { return snapshot_fd >= 0; }
+
+    // Throws std::runtime_error if the chunk can't be written, abandoning
+    // the snapshot.
+    void write_chunk(const kv_chunk& chunk)
+        {
+        enc.put(chunk.seq);
+        enc.put(static_cast<uint8_t>(chunk.last));
+        enc.put(static_cast<uint32_t>(chunk.entries.size()));
+
+        for ( const auto& kv : chunk.entries )
+            {
+            enc.put_bytes(kv.first.data(), kv.first.size());
+            enc.put_bytes(kv.second.data(), kv.second.size());
+            }
+
+        buf.clear();
+        enc.finish(buf);
+        write_snapshot(buf);
+
+        if ( chunk.last )
+            end_snapshot();
+        }
+
+private:
+
+    // "ACLOSNP1" and "ACLOWAL1", read little-endian.
+    static const uint64_t snapshot_magic = 0x31504e534f4c4341;
+    static const uint64_t segment_magic = 0x314c41574f4c4341;
+
+    std::string snapshot_path() const
+        { return dir + "/" + name + ".snapshot"; }
+
+    std::string snapshot_tmp_path() const
+        { return snapshot_path() + ".tmp"; }
+
+    std::string segment_path(uint64_t n) const
+        {
+        char suffix[32];
+        snprintf(suffix, sizeof(suffix), ".wal.%016llx",
+                 static_cast<unsigned long long>(n));
+        return dir + "/" + name + suffix;
+        }
+
+    std::vector<uint64_t> list_segments() const
+        {
+        std::vector<uint64_t> rval;
+        auto prefix = name + ".wal.";
+        DIR* d = opendir(dir.c_str());
+
+        if ( ! d )
+            return rval;
+
+        while ( auto e = readdir(d) )
+            {
+            std::string file = e->d_name;
+
+            if ( file.size() == prefix.size() + 16 &&
+                 file.compare(0, prefix.size(), prefix) == 0 )
+                rval.push_back(strtoull(file.c_str() + prefix.size(), 0, 16));
+            }
+
+        closedir(d);
+        std::sort(rval.begin(), rval.end());
+        return rval;
+        }
+
+    int open_segment(uint64_t n)
+        {
+        auto path = segment_path(n);
+        int fd = open(path.c_str(),
+                      O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+                      0644);
+
+        if ( fd < 0 )
+            throw std::runtime_error("can't create " + path);
+
+        record_encoder enc;
+        enc.put(segment_magic);
+        std::string header;
+        enc.finish(header);
+
+        if ( write(fd, header.data(), header.size()) !=
+             static_cast<ssize_t>(header.size()) )
+            {
+            close(fd);
+            throw std::runtime_error("can't write " + path);
+            }
+
+        sync_dir();
+        return fd;
+        }
+
+    void load_snapshot(snapshot_loader& loader, kv_sequence* start,
+                       uint64_t* first_segment)
+        {
+        mapped_file file(snapshot_path());
+        record_decoder dec(file.data(), file.size());
+        uint64_t magic;
+
+        if ( ! dec.next() || ! dec.get(&magic) || magic != snapshot_magic ||
+             ! dec.get(start) || ! dec.get(first_segment) )
+            throw std::runtime_error("bad snapshot header in " + name);
+
+        loader.start(0, *start, 0);
+        bool last = false;
+
+        while ( ! last && dec.next() )
+            {
+            kv_sequence seq;
+            uint8_t flag;
+            uint32_t n;
+
+            if ( ! dec.get(&seq) || ! dec.get(&flag) || ! dec.get(&n) )
+                break;
+
+            // Entries go straight from the mapped file into the store.
+            for ( uint32_t i = 0; i < n; ++i )
+                {
+                const char* k;
+                const char* v;
+                size_t klen, vlen;
+
+                if ( ! dec.get_bytes(&k, &klen) || ! dec.get_bytes(&v, &vlen) )
+                    throw std::runtime_error("bad snapshot chunk in " + name);
+
+                loader.put(key_view(k, klen), val_type(v, vlen));
+                }
+
+            last = flag;
+            loader.end_chunk(seq, last);
+            }
+
+        if ( ! last )
+            throw std::runtime_error("truncated snapshot of " + name);
+        }
+
+    // Defers the segment's updates after 'start' into 'loader'.  A record
+    // torn by a crash ends the segment.
+    void load_segment(uint64_t n, snapshot_loader& loader,
+                      const kv_sequence& start)
+        {
+        mapped_file file(segment_path(n));
+        record_decoder dec(file.data(), file.size());
+        uint64_t magic;
+
+        if ( ! dec.next() || ! dec.get(&magic) || magic != segment_magic )
+            return;
+
+        log_bytes += file.size();
+
+        while ( dec.next() )
+            {
+            kv_sequence seq;
+            kv_update u;
+            const char* k;
+            const char* v;
+            size_t klen, vlen;
+
+            if ( ! dec.get(&seq) || ! dec.get(&u.op) ||
+                 ! dec.get_bytes(&k, &klen) || ! dec.get_bytes(&v, &vlen) )
+                break;
+
+            if ( seq <= start )
+                continue;
+
+            u.key.assign(k, klen);
+            u.val = val_type(v, vlen);
+            loader.defer(seq, std::move(u));
+            }
+        }
+
+    void write_snapshot(const std::string& bytes)
+        {
+        const char* p = bytes.data();
+        size_t n = bytes.size();
+
+        while ( snapshot_fd >= 0 && n )
+            {
+            auto rc = write(snapshot_fd, p, n);
+
+            if ( rc < 0 && errno == EINTR )
+                continue;
+
+            if ( rc < 0 )
+                {
+                std::string err = strerror(errno);
+                close(snapshot_fd);
+                snapshot_fd = -1;
+                unlink(snapshot_tmp_path().c_str());
+                throw std::runtime_error("can't write " +
+                                         snapshot_tmp_path() + ": " + err);
+                }
+
+            p += rc;
+            n -= rc;
+            }
+        }
+
+    // Once the snapshot is on disk, it replaces the previous one and the
+    // log segments before it are no longer needed.
+    void end_snapshot()
+        {
+        if ( snapshot_fd < 0 )
+            return;
+
+        int fd = snapshot_fd;
+        snapshot_fd = -1;
+        auto first = segment;
+        auto tmp = snapshot_tmp_path();
+        auto path = snapshot_path();
+
+        writer->after_sync([this, fd, first, tmp, path]()
+            {
+            bool ok = fdatasync(fd) == 0;
+            close(fd);
+
+            if ( ! ok || rename(tmp.c_str(), path.c_str()) < 0 )
+                {
+                std::cerr << "ERROR: can't save snapshot " << path << ": "
+                          << strerror(errno) << std::endl;
+                unlink(tmp.c_str());
+                return;
+                }
+
+            sync_dir();
+
+            for ( auto n : list_segments() )
+                if ( n < first )
+                    unlink(segment_path(n).c_str());
+            });
+        }
+
+    void sync_dir() const
+        {
+        int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+        if ( fd < 0 )
+            return;
+
+        fsync(fd);
+        close(fd);
+        }
+
+    std::string dir;
+    std::string name;
+    size_t compact_bytes;
+    std::shared_ptr<store_stats> stats;
+    kv_store recovered;
+    // Number of the segment updates are appended to, and the bytes logged
+    // since the last snapshot started.
+    uint64_t segment = 0;
+    size_t log_bytes = 0;
+    int snapshot_fd = -1;
+    // Reused to encode each record.
+    record_encoder enc;
+    std::string buf;
+    // Declared last, so its thread is done before the rest is destroyed.
+    std::unique_ptr<wal_writer> writer;
+};
+
+} // namespace aclone
+
+#endif // ACLONE_DURABLE_HPP
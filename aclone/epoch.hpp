@@ -0,0 +1,205 @@
+#ifndef ACLONE_EPOCH_HPP
+#define ACLONE_EPOCH_HPP
+
+#include <atomic>
+#include <limits>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+#include <functional>
+
+namespace aclone {
+
+// Epoch-based reclamation for structures that are read without locks.
+// A reader announces the epoch it started in, in a slot of its own so
+// that readers on different threads never write to the same cache line.
+// Memory a writer unlinks is only freed once every announced epoch is
+// newer than the one it was retired in.
+class epoch_domain {
+public:
+
+    static const size_t max_readers = 256;
+
+    static epoch_domain& instance()
+        {
+        static epoch_domain domain;
+        return domain;
+        }
+
+    // Marks the calling thread as reading for its lifetime.  If the thread
+    // can't get a slot because too many threads read at once, valid() is
+    // false and the caller has to use some other way of reading.
+    class guard {
+    public:
+
+        guard()
+            { instance().enter(*this); }
+
+        ~guard()
+            {
+            if ( slot )
+                slot->store(0, std::memory_order_release);
+            }
+
+        guard(const guard&) = delete;
+        guard& operator=(const guard&) = delete;
+
+        bool valid() const
+            { return slot || nested; }
+
+    private:
+
+        std::atomic<uint64_t>* slot = nullptr;
+        bool nested = false;
+        friend class epoch_domain;
+    };
+
+    uint64_t current() const
+        { return epoch.load(std::memory_order_acquire); }
+
+    // Called by writers after retiring memory.
+    void advance()
+        { epoch.fetch_add(1, std::memory_order_acq_rel); }
+
+    // Oldest epoch a reader may still be in, or the maximum if none is.
+    uint64_t oldest_reader() const
+        {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t rval = std::numeric_limits<uint64_t>::max();
+
+        for ( const auto& s : slots )
+            {
+            auto e = s.epoch.load(std::memory_order_acquire);
+
+            if ( e && e < rval )
+                rval = e;
+            }
+
+        return rval;
+        }
+
+private:
+
+    struct alignas(64) reader_slot {
+        std::atomic<uint64_t> epoch;
+        std::atomic<bool> used;
+    };
+
+    // Releases a thread's slot when the thread exits.
+    struct thread_slot {
+        ~thread_slot()
+            {
+            if ( slot )
+                slot->used.store(false, std::memory_order_release);
+            }
+
+        reader_slot* slot = nullptr;
+    };
+
+    epoch_domain()
+        {
+        epoch.store(1, std::memory_order_relaxed);
+
+        for ( auto& s : slots )
+            {
+            s.epoch.store(0, std::memory_order_relaxed);
+            s.used.store(false, std::memory_order_relaxed);
+            }
+        }
+
+    // Announces the current epoch in the thread's slot, unless the thread
+    // already holds an outer guard, which keeps protecting it.
+    void enter(guard& g)
+        {
+        static thread_local thread_slot mine;
+
+        if ( ! mine.slot )
+            {
+            for ( auto& s : slots )
+                {
+                bool expected = false;
+
+                if ( s.used.compare_exchange_strong(expected, true) )
+                    {
+                    mine.slot = &s;
+                    break;
+                    }
+                }
+
+            if ( ! mine.slot )
+                return;
+            }
+
+        auto& e = mine.slot->epoch;
+
+        if ( e.load(std::memory_order_relaxed) )
+            {
+            g.nested = true;
+            return;
+            }
+
+        e.store(current(), std::memory_order_relaxed);
+        // Pairs with the fence in oldest_reader(): either the writer sees
+        // this announcement, or this reader sees the writer's unlinking.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        g.slot = &e;
+        }
+
+    std::atomic<uint64_t> epoch;
+    reader_slot slots[max_readers];
+};
+
+// Memory retired by a single writer, freed once readers have moved on.
+class reclaimer {
+public:
+
+    ~reclaimer()
+        {
+        // The owner guarantees there are no readers left by now.
+        for ( auto& r : retired )
+            r.second();
+        }
+
+    void retire(std::function<void ()> deleter)
+        {
+        auto& domain = epoch_domain::instance();
+        retired.emplace_back(domain.current(), std::move(deleter));
+
+        if ( retired.size() >= collect_threshold )
+            collect();
+        }
+
+    void collect()
+        {
+        auto& domain = epoch_domain::instance();
+        domain.advance();
+        auto oldest = domain.oldest_reader();
+        size_t kept = 0;
+
+        for ( size_t i = 0; i < retired.size(); ++i )
+            {
+            if ( retired[i].first < oldest )
+                retired[i].second();
+            else
+                {
+                if ( kept != i )
+                    retired[kept] = std::move(retired[i]);
+
+                ++kept;
+                }
+            }
+
+        retired.resize(kept);
+        }
+
+private:
+
+    static const size_t collect_threshold = 64;
+
+    std::vector<std::pair<uint64_t, std::function<void ()>>> retired;
+};
+
+} // namespace aclone
+
+#endif // ACLONE_EPOCH_HPP
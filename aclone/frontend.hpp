@@ -0,0 +1,85 @@
+#ifndef ACLONE_FRONTEND_HPP
+#define ACLONE_FRONTEND_HPP
+
+#include <string>
+#include <unordered_map>
+#include <cppa/cppa.hpp>
+
+#include "sharding.hpp"
+#include "queries.hpp"
+
+namespace aclone {
+
+// The actor published on a port, through which remote handles and cloners
+// find the master shards of any of the topics served there.  After that,
+// they talk to the shards directly, over the same connection.
+class frontend : public cppa::sb_actor<frontend> {
+friend class cppa::sb_actor<frontend>;
+
+public:
+
+    frontend()
+        {
+        using namespace cppa;
+        queries = (
+        on(atom("topology"), arg_match) >> [=](const std::string& topic)
+            {
+            return topology(topic);
+            }
+        );
+        serving = (
+        on(atom("quit")) >> [=]()
+            {
+            topics.clear();
+            quit();
+            },
+        on(atom("register"), arg_match) >> [=](const std::string& topic,
+                                               kv_shards& shards)
+            {
+            topics[topic] = std::move(shards);
+            },
+        on(atom("unregister"), arg_match) >> [=](const std::string& topic,
+                                                 const kv_shards& shards)
+            {
+            // Another store may have registered the topic since.
+            auto it = topics.find(topic);
+
+            if ( it != topics.end() && it->second == shards )
+                topics.erase(it);
+            },
+        on(atom("topology"), arg_match) >> [=](const std::string& topic)
+            {
+            return topology(topic);
+            },
+        on(atom("request"), arg_match) >> [=](uint64_t id, actor& reply_to,
+                                              any_tuple& query)
+            {
+            send(reply_to, atom("response"), id,
+                 query_result(queries, query));
+            }
+        );
+        }
+
+private:
+
+    // Unknown topics have no shards.
+    cppa::any_tuple topology(const std::string& topic) const
+        {
+        using namespace cppa;
+        auto it = topics.find(topic);
+
+        if ( it == topics.end() )
+            return make_cow_tuple(atom("topology"), kv_shards{});
+
+        return make_cow_tuple(atom("topology"), it->second);
+        }
+
+    std::unordered_map<std::string, kv_shards> topics;
+    cppa::partial_function queries;
+    cppa::behavior serving;
+    cppa::behavior& init_state = serving;
+};
+
+} // namespace aclone
+
+#endif // ACLONE_FRONTEND_HPP
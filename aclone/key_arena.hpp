@@ -0,0 +1,231 @@
+#ifndef ACLONE_KEY_ARENA_HPP
+#define ACLONE_KEY_ARENA_HPP
+
+#include <map>
+#include <string>
+#include <memory>
+#include <cstddef>
+#include <cstring>
+#include <utility>
+#include <ostream>
+#include <algorithm>
+
+namespace aclone {
+
+// A borrowed reference to a key's bytes, ordered the way std::string is.
+// Views of a caller's string are cheap to make for lookups; views a
+// key_arena hands out stay valid until the arena releases them.
+class key_view {
+public:
+
+    key_view()
+        : ptr(nullptr), len(0)
+        {}
+
+    key_view(const char* data, size_t size)
+        : ptr(data), len(size)
+        {}
+
+    key_view(const std::string& s)
+        : ptr(s.data()), len(s.size())
+        {}
+
+    const char* data() const
+        { return ptr; }
+
+    size_t size() const
+        { return len; }
+
+    std::string str() const
+        { return std::string(ptr, len); }
+
+    bool starts_with(const std::string& prefix) const
+        {
+        return len >= prefix.size() &&
+               memcmp(ptr, prefix.data(), prefix.size()) == 0;
+        }
+
+    int compare(const key_view& other) const
+        {
+        auto n = std::min(len, other.len);
+        int rval = n ? memcmp(ptr, other.ptr, n) : 0;
+
+        if ( rval )
+            return rval;
+
+        return len < other.len ? -1 : len > other.len;
+        }
+
+private:
+
+    const char* ptr;
+    size_t len;
+};
+
+inline bool operator<(const key_view& lhs, const key_view& rhs)
+    { return lhs.compare(rhs) < 0; }
+
+inline bool operator==(const key_view& lhs, const key_view& rhs)
+    {
+    return lhs.size() == rhs.size() &&
+           ( lhs.data() == rhs.data() ||
+             memcmp(lhs.data(), rhs.data(), lhs.size()) == 0 );
+    }
+
+inline bool operator!=(const key_view& lhs, const key_view& rhs)
+    { return ! operator==(lhs, rhs); }
+
+inline std::ostream& operator<<(std::ostream& os, const key_view& k)
+    { return os.write(k.data(), k.size()); }
+
+// Storage for the keys of a store.  Key bytes are packed into large slabs
+// instead of each getting a heap allocation of its own; a slab is reused
+// or freed once every key in it has been released.  The arena doesn't
+// deduplicate by itself: callers intern a key once (the store does so on
+// insert) and share the view it returns from then on.
+class key_arena {
+public:
+
+    static const size_t slab_size = 64 * 1024;
+
+    key_arena() = default;
+    key_arena(const key_arena&) = delete;
+    key_arena& operator=(const key_arena&) = delete;
+
+    // Views stay valid across moves, since slabs never do.
+    key_arena(key_arena&& other)
+        {
+        *this = std::move(other);
+        }
+
+    key_arena& operator=(key_arena&& other)
+        {
+        slabs = std::move(other.slabs);
+        current = other.current;
+        reserved_bytes = other.reserved_bytes;
+        live_bytes = other.live_bytes;
+        other.slabs.clear();
+        other.current = nullptr;
+        other.reserved_bytes = 0;
+        other.live_bytes = 0;
+        return *this;
+        }
+
+    // Copies a key in, returning a view that is stable until released.
+    key_view intern(const key_view& key)
+        {
+        if ( key.size() == 0 )
+            return key_view("", 0);
+
+        auto s = room_for(key.size());
+        char* dst = s->bytes.get() + s->used;
+        memcpy(dst, key.data(), key.size());
+        s->used += key.size();
+        ++s->live;
+        live_bytes += key.size();
+        return key_view(dst, key.size());
+        }
+
+    void release(const key_view& key)
+        {
+        if ( key.size() == 0 )
+            return;
+
+        live_bytes -= key.size();
+        auto it = --slabs.upper_bound(key.data());
+        auto s = it->second.get();
+
+        if ( --s->live )
+            return;
+
+        if ( s == current )
+            s->used = 0;
+        else
+            {
+            reserved_bytes -= s->size;
+            slabs.erase(it);
+            }
+        }
+
+    // Drops every key at once, keeping one slab around for reuse.
+    void clear()
+        {
+        std::unique_ptr<slab> keep;
+
+        if ( current )
+            {
+            keep = std::move(slabs[current->bytes.get()]);
+            keep->used = 0;
+            keep->live = 0;
+            }
+
+        slabs.clear();
+        reserved_bytes = 0;
+        live_bytes = 0;
+
+        if ( keep )
+            {
+            reserved_bytes = keep->size;
+            slabs[keep->bytes.get()] = std::move(keep);
+            }
+        }
+
+    // Heap bytes held in slabs, whether or not still in use.
+    size_t reserved() const
+        { return reserved_bytes; }
+
+    size_t live() const
+        { return live_bytes; }
+
+private:
+
+    struct slab {
+        explicit slab(size_t n)
+            : bytes(new char[n]), size(n)
+            {}
+
+        std::unique_ptr<char[]> bytes;
+        size_t size;
+        size_t used = 0;
+        size_t live = 0;
+    };
+
+    slab* room_for(size_t n)
+        {
+        if ( current && current->size - current->used >= n )
+            return current;
+
+        // Keys too large to share a slab get one of their own, leaving
+        // the current slab to keep filling up.
+        if ( n > slab_size / 4 )
+            return add_slab(n);
+
+        if ( current && ! current->live )
+            {
+            current->used = 0;
+            return current;
+            }
+
+        current = add_slab(slab_size);
+        return current;
+        }
+
+    slab* add_slab(size_t n)
+        {
+        std::unique_ptr<slab> s(new slab(n));
+        auto rval = s.get();
+        reserved_bytes += n;
+        slabs[rval->bytes.get()] = std::move(s);
+        return rval;
+        }
+
+    // Slabs by start address, to find the one a released key lives in.
+    std::map<const char*, std::unique_ptr<slab>> slabs;
+    slab* current = nullptr;
+    size_t reserved_bytes = 0;
+    size_t live_bytes = 0;
+};
+
+} // namespace aclone
+
+#endif // ACLONE_KEY_ARENA_HPP
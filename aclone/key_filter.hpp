@@ -0,0 +1,154 @@
+#ifndef ACLONE_KEY_FILTER_HPP
+#define ACLONE_KEY_FILTER_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+
+#include "kv_store.hpp"
+
+namespace aclone {
+
+// The keys a partial replica holds: a union of half-open ranges of keys,
+// [first, last), an empty 'last' leaving a range unbounded.  The ranges are
+// kept sorted and disjoint, so that a key is checked with a binary search
+// and a store's matching entries are found with one seek per range.  A
+// filter without any ranges lets every key through.
+class kv_filter {
+public:
+
+    struct range {
+        key_type first;
+        key_type last;
+    };
+
+    // Adds the range of keys that start with 'prefix'.
+    void add_prefix(const key_type& prefix)
+        {
+        // Those all sort before the prefix with its last byte incremented,
+        // once any trailing 0xff bytes are dropped.
+        auto last = prefix;
+
+        while ( ! last.empty() && static_cast<uint8_t>(last.back()) == 0xff )
+            last.pop_back();
+
+        if ( ! last.empty() )
+            last.back() = static_cast<char>(
+                static_cast<uint8_t>(last.back()) + 1);
+
+        add_range(prefix, std::move(last));
+        }
+
+    // Throws std::invalid_argument if the range has no keys in it.
+    void add_range(key_type first, key_type last)
+        {
+        if ( ! last.empty() && last <= first )
+            throw std::invalid_argument("empty key range");
+
+        ranges.push_back(range{std::move(first), std::move(last)});
+        std::sort(ranges.begin(), ranges.end(),
+                  [](const range& a, const range& b)
+                      { return a.first < b.first; });
+        std::vector<range> merged;
+
+        for ( auto& r : ranges )
+            {
+            if ( merged.empty() || ! reaches(merged.back(), r.first) )
+                {
+                merged.push_back(std::move(r));
+                continue;
+                }
+
+            auto& m = merged.back();
+
+            if ( ! m.last.empty() && ( r.last.empty() || m.last < r.last ) )
+                m.last = std::move(r.last);
+            }
+
+        ranges.swap(merged);
+        }
+
+    // Whether every key passes.
+    bool all() const
+        { return ranges.empty(); }
+
+    bool covers(const key_view& key) const
+        {
+        if ( ranges.empty() )
+            return true;
+
+        auto it = std::upper_bound(ranges.begin(), ranges.end(), key,
+                                   [](const key_view& k, const range& r)
+                                       { return k < key_view(r.first); });
+
+        if ( it == ranges.begin() )
+            return false;
+
+        --it;
+        return it->last.empty() || key < key_view(it->last);
+        }
+
+    // Whether a replica holding these keys is affected by an update.
+    bool covers(const kv_update& u) const
+        { return u.op == KV_OP_CLEAR || covers(key_view(u.key)); }
+
+    // The first entry of 'map', from 'it' on, whose key passes.
+    kv_map::const_iterator seek(const kv_map& map,
+                                kv_map::const_iterator it) const
+        {
+        if ( ranges.empty() )
+            return it;
+
+        while ( it != map.end() )
+            {
+            // The first range that doesn't end at or before the key.
+            auto r = std::partition_point(ranges.begin(), ranges.end(),
+                [&](const range& r)
+                    {
+                    return ! r.last.empty() &&
+                           ! ( it->first < key_view(r.last) );
+                    });
+
+            if ( r == ranges.end() )
+                return map.end();
+
+            if ( ! ( it->first < key_view(r->first) ) )
+                return it;
+
+            it = map.lower_bound(key_view(r->first));
+            }
+
+        return it;
+        }
+
+    const std::vector<range>& key_ranges() const
+        { return ranges; }
+
+private:
+
+    // Whether a range reaches, or runs right up to, a key.
+    static bool reaches(const range& r, const key_type& key)
+        { return r.last.empty() || ! ( r.last < key ); }
+
+    std::vector<range> ranges;
+};
+
+inline bool operator==(const kv_filter& lhs, const kv_filter& rhs)
+    {
+    const auto& a = lhs.key_ranges();
+    const auto& b = rhs.key_ranges();
+    return a.size() == b.size() &&
+           std::equal(a.begin(), a.end(), b.begin(),
+                      [](const kv_filter::range& x, const kv_filter::range& y)
+                          { return x.first == y.first && x.last == y.last; });
+    }
+
+inline bool operator!=(const kv_filter& lhs, const kv_filter& rhs)
+    { return ! operator==(lhs, rhs); }
+
+} // namespace aclone
+
+#endif // ACLONE_KEY_FILTER_HPP
@@ -1,36 +1,27 @@
 #ifndef ACLONE_KV_SEQUENCE_HPP
 #define ACLONE_KV_SEQUENCE_HPP
 
-#include <vector>
 #include <cstdint>
 
 namespace aclone {
 
+// 128-bit update counter.  Trivially copyable, so taking the next sequence,
+// comparing and incrementing never allocate.
 class kv_sequence {
 public:
 
     kv_sequence next() const
         {
         kv_sequence rval = *this;
-        std::vector<uint64_t>& n = rval.sequence;
-
-        for ( int i = n.size() - 1; i >= 0; --i )
-            {
-            ++n[i];
-
-            if ( n[i] != 0 )
-                break;
-
-            if ( i == 0 )
-                n.insert(n.begin(), 1);
-            }
-
+        ++rval;
         return rval;
         }
 
     kv_sequence& operator++()
         {
-        sequence = move(next().sequence);
+        if ( ++lo == 0 )
+            ++hi;
+
         return *this;
         }
 
@@ -41,19 +32,26 @@ public:
         return tmp;
         }
 
-    std::vector<uint64_t> sequence = { 0 };
+    kv_sequence& operator+=(uint64_t n)
+        {
+        lo += n;
+
+        if ( lo < n )
+            ++hi;
+
+        return *this;
+        }
+
+    uint64_t hi = 0;
+    uint64_t lo = 0;
 };
 
 inline bool operator==(const kv_sequence& lhs, const kv_sequence& rhs)
-    { return lhs.sequence == rhs.sequence; }
+    { return lhs.lo == rhs.lo && lhs.hi == rhs.hi; }
 inline bool operator!=(const kv_sequence& lhs, const kv_sequence& rhs)
     { return ! operator==(lhs,rhs); }
 inline bool operator<(const kv_sequence& lhs, const kv_sequence& rhs)
-    {
-    if ( lhs.sequence.size() == rhs.sequence.size() )
-        return lhs.sequence < rhs.sequence;
-    return lhs.sequence.size() < rhs.sequence.size();
-    }
+    { return lhs.hi < rhs.hi || ( lhs.hi == rhs.hi && lhs.lo < rhs.lo ); }
 inline bool operator>(const kv_sequence& lhs, const kv_sequence& rhs)
     { return operator<(rhs,lhs); }
 inline bool operator<=(const kv_sequence& lhs, const kv_sequence& rhs)
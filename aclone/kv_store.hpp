@@ -4,40 +4,184 @@
 #include <string>
 #include <cstdint>
 #include <map>
+#include <vector>
+#include <iterator>
 
 #include "kv_sequence.hpp"
+#include "kv_value.hpp"
+#include "key_arena.hpp"
 
 namespace aclone {
 
-using val_type = int64_t;
+using val_type = kv_value;
 using key_type = std::string;
 
+enum KVop {
+    KV_OP_INSERT,
+    KV_OP_INCREMENT,
+    KV_OP_DECREMENT,
+    KV_OP_REMOVE,
+    KV_OP_CLEAR,
+    // A removal by a master whose TTL for the key ran out.
+    KV_OP_EXPIRE,
+    // Stands in for a run of updates left out of a partial replica's
+    // stream, 'val' holding how many, so that its sequence keeps up.
+    KV_OP_SKIP,
+};
+
+struct kv_update {
+    uint8_t op;
+    key_type key;
+    val_type val;
+};
+
+inline bool operator==(const kv_update& lhs, const kv_update& rhs)
+    { return lhs.op == rhs.op && lhs.key == rhs.key && lhs.val == rhs.val; }
+
+// The number of sequence numbers an update takes up.
+inline uint64_t sequences(const kv_update& u)
+    { return u.op == KV_OP_SKIP ? u.val.as_int() : 1; }
+
+// Updates applied atomically under consecutive sequence numbers.
+using kv_batch = std::vector<kv_update>;
+using kv_keys = std::vector<key_type>;
+
+// A store's entries.  Keys are views into the store's key_arena, so each
+// distinct key is copied once, when first inserted, and looking one up
+// from a key_type doesn't copy it at all.
+using kv_map = std::map<key_view, val_type>;
+
 class kv_store {
 public:
 
+    kv_store() = default;
+    kv_store(kv_store&&) = default;
+    kv_store& operator=(kv_store&&) = default;
+    kv_store(const kv_store&) = delete;
+    kv_store& operator=(const kv_store&) = delete;
+
     void update(const key_type& key, const val_type& val)
         {
         ++sequence;
-        store[key] = val;
+        put(key, val);
+        }
+
+    // Sets a key without taking up a sequence number, as when loading a
+    // snapshot.
+    void put(const key_view& key, val_type val)
+        {
+        // Snapshots arrive in key order, so check for appending first.
+        auto it = store.empty() || store.rbegin()->first < key
+                  ? store.end() : store.lower_bound(key);
+        val_bytes += val.heap_bytes();
+
+        if ( it != store.end() && it->first == key )
+            {
+            val_bytes -= it->second.heap_bytes();
+            it->second = std::move(val);
+            }
+        else
+            store.emplace_hint(it, keys.intern(key), std::move(val));
+        }
+
+    // Adds to an 8-byte integer value, treating a missing key as zero.
+    // Values of other sizes are left alone, but the update still takes up
+    // a sequence number so masters and cloners stay in step.
+    void increment(const key_type& key, int64_t by)
+        {
+        ++sequence;
+        auto it = store.lower_bound(key);
+
+        if ( it == store.end() || it->first != key )
+            store.emplace_hint(it, keys.intern(key), kv_value::from_int(by));
+        else if ( it->second.is_int() )
+            {
+            uint64_t n = it->second.as_int();
+            it->second = kv_value::from_int(static_cast<int64_t>(n + by));
+            }
         }
 
     void remove(const key_type& key)
         {
         ++sequence;
-        store.erase(key);
+        auto it = store.find(key);
+
+        if ( it == store.end() )
+            return;
+
+        erase(it, std::next(it));
         }
 
     void clear()
         {
         ++sequence;
         store.clear();
+        keys.clear();
+        val_bytes = 0;
+        }
+
+    // Drops a range of entries without taking up a sequence number.
+    void erase(kv_map::iterator first, kv_map::iterator last)
+        {
+        for ( auto it = first; it != last; ++it )
+            {
+            keys.release(it->first);
+            val_bytes -= it->second.heap_bytes();
+            }
+
+        store.erase(first, last);
+        }
+
+    void apply(const kv_update& u)
+        {
+        switch ( u.op ) {
+        case KV_OP_INSERT:
+            update(u.key, u.val);
+            break;
+        case KV_OP_INCREMENT:
+            increment(u.key, u.val.as_int());
+            break;
+        case KV_OP_DECREMENT:
+            increment(u.key, -static_cast<uint64_t>(u.val.as_int()));
+            break;
+        case KV_OP_REMOVE:
+        case KV_OP_EXPIRE:
+            remove(u.key);
+            break;
+        case KV_OP_CLEAR:
+            clear();
+            break;
+        case KV_OP_SKIP:
+            sequence += u.val.as_int();
+            break;
+        }
+        }
+
+    // Rough heap footprint: map nodes, the key arena's slabs, and values
+    // too large to be stored inline.
+    size_t memory_usage() const
+        {
+        return store.size() * (sizeof(*store.begin()) + 4 * sizeof(void*)) +
+               keys.reserved() + val_bytes;
+        }
+
+    // Recomputes bookkeeping after values in 'store' were modified directly.
+    void recount()
+        {
+        val_bytes = 0;
+
+        for ( const auto& kv : store )
+            val_bytes += kv.second.heap_bytes();
         }
 
     kv_sequence nextseq() const
         { return sequence.next(); }
 
-    std::map<key_type, val_type> store;
+    // Declared before 'store' so it outlives the views in there.
+    key_arena keys;
+    kv_map store;
     kv_sequence sequence;
+    size_t val_bytes = 0;
 };
 
 inline bool operator==(const kv_store& lhs, const kv_store& rhs)
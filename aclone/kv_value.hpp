@@ -0,0 +1,160 @@
+#ifndef ACLONE_KV_VALUE_HPP
+#define ACLONE_KV_VALUE_HPP
+
+#include <new>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <ostream>
+
+namespace aclone {
+
+// An opaque, immutable byte string.  Values of up to inline_capacity bytes
+// are stored in the object itself; larger ones live in a heap buffer that
+// copies share by reference count, so the store, the replay log and every
+// message carrying an update all refer to the same payload.
+class kv_value {
+public:
+
+    static const size_t inline_capacity = 22;
+
+    kv_value()
+        : len(0), large(false)
+        {}
+
+    kv_value(const void* data, size_t size)
+        : len(static_cast<uint32_t>(size)), large(size > inline_capacity)
+        {
+        if ( large )
+            {
+            char* buf = new char[size];
+            memcpy(buf, data, size);
+            new (&shared) buffer(buf, std::default_delete<char[]>());
+            }
+        else if ( size )
+            memcpy(small, data, size);
+        }
+
+    // Shares an existing buffer instead of copying it, unless the value is
+    // small enough to be stored inline.
+    kv_value(std::shared_ptr<const char> buf, size_t size)
+        : len(static_cast<uint32_t>(size)), large(size > inline_capacity)
+        {
+        if ( large )
+            new (&shared) buffer(std::move(buf));
+        else if ( size )
+            memcpy(small, buf.get(), size);
+        }
+
+    // Values incremented and decremented are 8-byte integers in host order.
+    static kv_value from_int(int64_t n)
+        {
+        return kv_value(&n, sizeof(n));
+        }
+
+    kv_value(const kv_value& other)
+        : len(other.len), large(other.large)
+        {
+        if ( large )
+            new (&shared) buffer(other.shared);
+        else
+            memcpy(small, other.small, len);
+        }
+
+    kv_value(kv_value&& other)
+        : len(0), large(false)
+        {
+        take(other);
+        }
+
+    kv_value& operator=(kv_value other)
+        {
+        release();
+        take(other);
+        return *this;
+        }
+
+    ~kv_value()
+        {
+        release();
+        }
+
+    const char* data() const
+        { return large ? shared.get() : small; }
+
+    size_t size() const
+        { return len; }
+
+    bool is_int() const
+        { return len == sizeof(int64_t); }
+
+    int64_t as_int() const
+        {
+        int64_t rval = 0;
+
+        if ( is_int() )
+            memcpy(&rval, data(), sizeof(rval));
+
+        return rval;
+        }
+
+    // Heap bytes owned (or shared) beyond the object itself.
+    size_t heap_bytes() const
+        { return large ? len : 0; }
+
+private:
+
+    using buffer = std::shared_ptr<const char>;
+
+    void release()
+        {
+        if ( large )
+            shared.~buffer();
+
+        len = 0;
+        large = false;
+        }
+
+    void take(kv_value& other)
+        {
+        len = other.len;
+        large = other.large;
+
+        if ( large )
+            new (&shared) buffer(std::move(other.shared));
+        else
+            memcpy(small, other.small, len);
+        }
+
+    uint32_t len;
+    bool large;
+
+    union {
+        char small[inline_capacity];
+        buffer shared;
+    };
+};
+
+inline bool operator==(const kv_value& lhs, const kv_value& rhs)
+    {
+    return lhs.size() == rhs.size() &&
+           ( lhs.data() == rhs.data() ||
+             memcmp(lhs.data(), rhs.data(), lhs.size()) == 0 );
+    }
+
+inline bool operator!=(const kv_value& lhs, const kv_value& rhs)
+    { return ! operator==(lhs, rhs); }
+
+// Integers print as such, anything else as its length.
+inline std::ostream& operator<<(std::ostream& os, const kv_value& v)
+    {
+    if ( v.is_int() )
+        return os << v.as_int();
+
+    return os << "<" << v.size() << " bytes>";
+    }
+
+} // namespace aclone
+
+#endif // ACLONE_KV_VALUE_HPP
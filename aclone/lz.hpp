@@ -0,0 +1,189 @@
+#ifndef ACLONE_LZ_HPP
+#define ACLONE_LZ_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+namespace aclone {
+
+// A small LZ77 block codec, in the style of LZ4: fast to compress and
+// faster to decompress, which suits snapshot chunks' repetitive keys.
+//
+// A block is a series of sequences, each a token byte (literal count in
+// the high nibble, match length minus lz_min_match in the low one, 15
+// meaning more follows in bytes that are added up until one isn't 255),
+// the literals, and then a match: a 16-bit little-endian offset back into
+// the output and its length's extra bytes.  The last sequence has only
+// literals.  The decompressed size isn't recorded; callers keep it.
+
+static const size_t lz_min_match = 4;
+static const size_t lz_max_offset = 65535;
+
+inline void lz_put_length(size_t n, std::string* out)
+    {
+    while ( n >= 255 )
+        {
+        out->push_back(static_cast<char>(255));
+        n -= 255;
+        }
+
+    out->push_back(static_cast<char>(n));
+    }
+
+inline void lz_put_sequence(const char* lit, size_t nlit, size_t offset,
+                            size_t match, std::string* out)
+    {
+    size_t mlen = match ? match - lz_min_match : 0;
+    uint8_t token = (std::min<size_t>(nlit, 15) << 4) |
+                    std::min<size_t>(mlen, 15);
+    out->push_back(static_cast<char>(token));
+
+    if ( nlit >= 15 )
+        lz_put_length(nlit - 15, out);
+
+    out->append(lit, nlit);
+
+    if ( ! match )
+        return;
+
+    out->push_back(static_cast<char>(offset & 0xff));
+    out->push_back(static_cast<char>(offset >> 8));
+
+    if ( mlen >= 15 )
+        lz_put_length(mlen - 15, out);
+    }
+
+// Appends the compressed form of the 'n' bytes at 'src' to 'out'.
+inline void lz_compress(const char* src, size_t n, std::string* out)
+    {
+    static const int hash_bits = 14;
+    std::vector<uint32_t> table(1 << hash_bits, 0);
+    auto hash = [&](size_t pos)
+        {
+        uint32_t v;
+        memcpy(&v, src + pos, sizeof(v));
+        return (v * 2654435761u) >> (32 - hash_bits);
+        };
+
+    size_t anchor = 0;
+    size_t pos = 0;
+    // Matches stop short of the end, so the last bytes are literals.
+    size_t limit = n > 8 ? n - 8 : 0;
+
+    while ( pos < limit )
+        {
+        auto h = hash(pos);
+        // Positions are stored plus one, so zero means empty.
+        size_t cand = table[h];
+        table[h] = pos + 1;
+
+        if ( ! cand-- || pos - cand > lz_max_offset ||
+             memcmp(src + cand, src + pos, lz_min_match) != 0 )
+            {
+            ++pos;
+            continue;
+            }
+
+        size_t match = lz_min_match;
+
+        while ( pos + match < n && src[cand + match] == src[pos + match] )
+            ++match;
+
+        lz_put_sequence(src + anchor, pos - anchor, pos - cand, match, out);
+        pos += match;
+        anchor = pos;
+        }
+
+    lz_put_sequence(src + anchor, n - anchor, 0, 0, out);
+    }
+
+// Appends the 'raw_size' bytes that the 'n' bytes at 'src' decompress to
+// to 'out', throwing std::runtime_error if they are malformed.
+inline void lz_decompress(const char* src, size_t n, size_t raw_size,
+                          std::string* out)
+    {
+    auto p = reinterpret_cast<const uint8_t*>(src);
+    auto end = p + n;
+    size_t produced = 0;
+
+    auto fail = []()
+        { throw std::runtime_error("malformed compressed block"); };
+
+    // No input byte expands to more than 255 output bytes, which bounds
+    // what a corrupt size can make this allocate.
+    if ( raw_size / 255 > n )
+        fail();
+
+    size_t base = out->size();
+    out->resize(base + raw_size);
+    char* dst = &(*out)[0] + base;
+
+    auto get_length = [&](size_t n)
+        {
+        for ( ; ; )
+            {
+            if ( p == end )
+                fail();
+
+            uint8_t b = *p++;
+            n += b;
+
+            if ( b != 255 )
+                return n;
+            }
+        };
+
+    for ( ; ; )
+        {
+        if ( p == end )
+            fail();
+
+        uint8_t token = *p++;
+        size_t nlit = token >> 4;
+
+        if ( nlit == 15 )
+            nlit = get_length(nlit);
+
+        if ( static_cast<size_t>(end - p) < nlit ||
+             raw_size - produced < nlit )
+            fail();
+
+        memcpy(dst + produced, p, nlit);
+        p += nlit;
+        produced += nlit;
+
+        if ( p == end )
+            break;
+
+        if ( end - p < 2 )
+            fail();
+
+        size_t offset = p[0] | (p[1] << 8);
+        p += 2;
+        size_t match = token & 0x0f;
+
+        if ( match == 15 )
+            match = get_length(match);
+
+        match += lz_min_match;
+
+        if ( offset == 0 || offset > produced ||
+             raw_size - produced < match )
+            fail();
+
+        // Byte by byte, since a match may overlap what it copies.
+        for ( size_t i = 0; i < match; ++i, ++produced )
+            dst[produced] = dst[produced - offset];
+        }
+
+    if ( produced != raw_size )
+        fail();
+    }
+
+} // namespace aclone
+
+#endif // ACLONE_LZ_HPP
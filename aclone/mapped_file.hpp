@@ -0,0 +1,71 @@
+#ifndef ACLONE_MAPPED_FILE_HPP
+#define ACLONE_MAPPED_FILE_HPP
+
+#include <string>
+#include <cstddef>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace aclone {
+
+// A file mapped read-only in its entirety, with the kernel told how it's
+// going to be accessed.
+class mapped_file {
+public:
+
+    explicit mapped_file(const std::string& path,
+                         int advice = MADV_SEQUENTIAL)
+        {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+
+        if ( fd < 0 )
+            throw std::runtime_error("can't open " + path);
+
+        if ( fstat(fd, &st) < 0 )
+            {
+            close(fd);
+            throw std::runtime_error("can't stat " + path);
+            }
+
+        len = st.st_size;
+
+        if ( len )
+            base = mmap(0, len, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        close(fd);
+
+        if ( base == MAP_FAILED )
+            throw std::runtime_error("can't map " + path);
+
+        if ( len )
+            madvise(base, len, advice);
+        }
+
+    ~mapped_file()
+        {
+        if ( len )
+            munmap(base, len);
+        }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    const char* data() const
+        { return static_cast<const char*>(base); }
+
+    size_t size() const
+        { return len; }
+
+private:
+
+    void* base = nullptr;
+    size_t len = 0;
+};
+
+} // namespace aclone
+
+#endif // ACLONE_MAPPED_FILE_HPP
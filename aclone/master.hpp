@@ -4,10 +4,23 @@
 #include <string>
 #include <sstream>
 #include <iostream>
+#include <memory>
+#include <random>
+#include <algorithm>
 #include <unordered_map>
 #include <cppa/cppa.hpp>
 
+#include "aclone/aclone.h"
 #include "kv_store.hpp"
+#include "replay_log.hpp"
+#include "snapshot.hpp"
+#include "durable.hpp"
+#include "stats.hpp"
+#include "queries.hpp"
+#include "wire.hpp"
+#include "chunk_codec.hpp"
+#include "timer_wheel.hpp"
+#include "key_filter.hpp"
 
 namespace aclone {
 
@@ -28,14 +41,84 @@ static void dbg_dump(const cppa::actor& a, const std::string& store_id,
     aout(a) << ss.str();
     }
 
+// The message a run of updates from sequence 'first' is published in.
+template <typename It>
+static cppa::any_tuple packed_msg(const kv_sequence& first, It begin, It end)
+    {
+    using namespace cppa;
+    return make_cow_tuple(atom("packed"), kv_packed::encode(first, begin, end));
+    }
+
 class master : public cppa::sb_actor<master> {
 friend class cppa::sb_actor<master>;
 
 public:
 
-    master()
+    // A durable master starts from the store 'arg_wal' recovered.
+    master(const aclone_master_config& config,
+           std::shared_ptr<store_stats> shared_stats,
+           std::shared_ptr<durable_log> arg_wal = nullptr)
+        : epoch(make_epoch()), log(config.replay_log_size),
+          chunk_bytes(config.snapshot_chunk_bytes),
+          codecs(config.snapshot_codecs),
+          flush_us(config.publish_flush_us),
+          flush_ops(config.publish_max_ops),
+          flush_bytes(config.publish_max_bytes),
+          heartbeat_ms(config.filter_heartbeat_ms),
+          tick_ns(std::max(config.expiry_tick_ms, uint32_t(1)) * 1000000LL),
+          expiries(now_tick()),
+          stats(std::move(shared_stats)), wal(std::move(arg_wal))
         {
         using namespace cppa;
+
+        if ( wal )
+            {
+            wal->restore(store);
+            counter_set(stats->keys, store.store.size());
+            counter_set(stats->memory, store.memory_usage());
+            }
+
+        queries = (
+        on(atom("lookup"), arg_match) >> [=](key_type& key)
+            {
+            return lookup_response(store, *stats, key);
+            },
+        on(atom("haskey"), arg_match) >> [=](key_type& key)
+            {
+            return haskey_response(store, *stats, key);
+            },
+        on(atom("lookup_multi"), arg_match) >> [=](kv_keys& keys)
+            {
+            return lookup_multi_response(store, *stats, keys);
+            },
+        on(atom("haskey_multi"), arg_match) >> [=](kv_keys& keys)
+            {
+            return haskey_multi_response(store, *stats, keys);
+            },
+        on(atom("keys"), arg_match) >> [=](key_type& prefix, key_type& after,
+                                           bool resume, uint64_t limit,
+                                           bool with_values)
+            {
+            return keys_response(store, *stats, prefix, after, resume, limit,
+                                 with_values);
+            },
+        on(atom("size")) >> [=]()
+            {
+            return size_response(store, *stats);
+            },
+        // Read-modify-writes, answered like queries but applied and
+        // published like updates.
+        on(atom("fetch_add"), arg_match) >> [=](key_type& key, val_type& by)
+            {
+            return fetch_add(key, by);
+            },
+        on(atom("cas"), arg_match) >> [=](key_type& key, bool expect_present,
+                                          val_type& expected,
+                                          val_type& desired)
+            {
+            return compare_and_swap(key, expect_present, expected, desired);
+            }
+        );
         serving = (
         on(atom("quit")) >> [=]()
             {
@@ -44,78 +127,671 @@ public:
         // Update Messages
         on(atom("insert"), arg_match) >> [=](key_type& key, val_type& val)
             {
+            if ( log_failed() )
+                return;
+
+            auto start = now_ns();
             store.update(key, val);
-            publish(make_cow_tuple(atom("insert"), store.sequence, key, val));
-            dbg_dump(this, idstr(), store);
+            untimed(key);
+            publish(kv_update{KV_OP_INSERT, std::move(key), val});
+            counter_add(stats->inserts);
+            updated(start);
+            },
+        on(atom("insert_ttl"), arg_match) >> [=](key_type& key, val_type& val,
+                                                 uint64_t ttl_ms)
+            {
+            if ( log_failed() )
+                return;
+
+            auto start = now_ns();
+            store.update(key, val);
+            // Rounded up, so that keys never expire early.
+            expire_at(key, (start + ttl_ms * 1000000 + tick_ns - 1) / tick_ns);
+            publish(kv_update{KV_OP_INSERT, std::move(key), val});
+            counter_add(stats->inserts);
+            updated(start);
             },
         on(atom("increment"), arg_match) >> [=](key_type& key, val_type& by)
             {
-            store.update(key, store.store[key] + by);
-            publish(make_cow_tuple(atom("increment"), store.sequence, key, by));
-            dbg_dump(this, idstr(), store);
+            if ( log_failed() )
+                return;
+
+            auto start = now_ns();
+            store.increment(key, by.as_int());
+            publish(kv_update{KV_OP_INCREMENT, std::move(key), by});
+            counter_add(stats->increments);
+            updated(start);
             },
         on(atom("decrement"), arg_match) >> [=](key_type& key, val_type& by)
             {
-            store.update(key, store.store[key] - by);
-            publish(make_cow_tuple(atom("decrement"), store.sequence, key, by));
-            dbg_dump(this, idstr(), store);
+            if ( log_failed() )
+                return;
+
+            auto start = now_ns();
+            store.increment(key, -by.as_int());
+            publish(kv_update{KV_OP_DECREMENT, std::move(key), by});
+            counter_add(stats->decrements);
+            updated(start);
             },
         on(atom("remove"), arg_match) >> [=](key_type& key)
             {
+            if ( log_failed() )
+                return;
+
+            auto start = now_ns();
             store.remove(key);
-            publish(make_cow_tuple(atom("remove"), store.sequence, key));
-            dbg_dump(this, idstr(), store);
+            untimed(key);
+            publish(kv_update{KV_OP_REMOVE, std::move(key), val_type{}});
+            counter_add(stats->removes);
+            updated(start);
             },
         on(atom("clear")) >> [=]()
             {
+            if ( log_failed() )
+                return;
+
+            auto start = now_ns();
             store.clear();
-            publish(make_cow_tuple(atom("clear"), store.sequence));
-            dbg_dump(this, idstr(), store);
+            untimed_all();
+            publish(kv_update{KV_OP_CLEAR, key_type{}, val_type{}});
+            counter_add(stats->clears);
+            updated(start);
+            },
+        on(atom("batch"), arg_match) >> [=](kv_batch& ops)
+            {
+            if ( ops.empty() || log_failed() )
+                return;
+
+            auto start = now_ns();
+            kv_sequence first = store.nextseq();
+
+            for ( const auto& u : ops )
+                {
+                store.apply(u);
+                counter_add(stats->updates(u.op));
+
+                if ( u.op == KV_OP_CLEAR )
+                    untimed_all();
+                else if ( u.op == KV_OP_INSERT || u.op == KV_OP_REMOVE )
+                    untimed(u.key);
+                }
+
+            publish(first, ops);
+            updated(start);
+            },
+        on(atom("expire")) >> [=]()
+            {
+            expire_pending = false;
+            expire();
+
+            if ( ! expiries.empty() )
+                schedule_expiry();
             },
         // Request Messages
-        on(atom("snapshot"), arg_match) >> [=](actor& sender)
+        on(atom("snapshot"), arg_match) >> [=](actor& sender, uint32_t offered,
+                                               kv_filter& filter)
             {
             auto sender_addr = last_sender();
+            flush();
+            subscribe(sender_addr, sender, filter);
+            counter_add(stats->snapshots);
+            // The store is streamed in chunks between other messages rather
+            // than as one tuple; the reply tells the subscriber where the
+            // stream starts, and which of the codecs it offered are used.
+            auto& s = streams[sender_addr];
+            ++s.id;
+            s.codecs = offered & codecs;
+            s.filter = std::move(filter);
+            send(this, atom("stream"), sender, s.id, false, key_type{});
+            return make_cow_tuple(atom("snapshot"), epoch, store.sequence, s.id,
+                                  s.codecs);
+            },
+        on(atom("stream"), arg_match) >> [=](actor& dst, uint64_t id,
+                                             bool resume, key_type& after)
+            {
+            auto it = streams.find(dst.address());
+
+            // Subscriber went away or restarted its snapshot.
+            if ( it == streams.end() || it->second.id != id )
+                return;
+
+            // Everything a chunk reflects must reach the subscriber first.
+            flush();
+
+            auto chunk = cut_chunk(store, resume, after, chunk_bytes,
+                                   it->second.filter);
+            auto packed = pack_chunk(chunk, it->second.codecs, *stats);
+
+            if ( ! chunk.last )
+                send(this, atom("stream"), dst, id, true,
+                     chunk.entries.rbegin()->first);
+            else
+                streams.erase(it);
+
+            send(dst, atom("chunk"), id, std::move(packed));
+            },
+        on(atom("compact"), arg_match) >> [=](bool resume, key_type& after)
+            {
+            // Chunks are cut between other messages, like streamed ones.
+            if ( ! wal->snapshotting() )
+                return;
 
-            if ( subscribers.find(sender_addr) == subscribers.end() )
+            auto chunk = cut_chunk(store, resume, after, chunk_bytes);
+
+            try
+                {
+                wal->write_chunk(chunk);
+                }
+            catch ( std::exception& e )
                 {
-                monitor(sender_addr);
-                subscribers[sender_addr] = sender;
+                aout(this) << "ERROR: " << idstr() << " snapshot failed: "
+                           << e.what() << std::endl;
+                return;
                 }
 
-            return make_cow_tuple(store);
+            if ( ! chunk.last )
+                send(this, atom("compact"), true,
+                     chunk.entries.rbegin()->first);
             },
-        on(atom("lookup"), arg_match) >> [=](key_type& key)
+        on(atom("replay"), arg_match) >> [=](uint64_t sender_epoch,
+                                             kv_sequence& since, actor& sender,
+                                             kv_filter& filter)
             {
-            auto it = store.store.find(key);
-            if ( it == store.store.end() )
-                return make_cow_tuple(atom("null"), static_cast<val_type>(0));
+            flush();
+
+            if ( sender_epoch != epoch || ! log.covers(since, store.sequence) )
+                return make_cow_tuple(atom("stale"));
+
+            auto sender_addr = last_sender();
+            subscribe(sender_addr, sender, filter);
+            counter_add(stats->replays);
+            auto it = partials.find(sender_addr);
+
+            if ( it == partials.end() )
+                log.replay(since, [&](const any_tuple& msg)
+                    { send_tuple(sender, msg); });
             else
-                return make_cow_tuple(atom("ok"), it->second);
+                {
+                // The log holds whole runs, which are filtered again.
+                log.replay(since, [&](const any_tuple& msg)
+                    {
+                    kv_batch ops;
+                    auto first = msg.get_as<kv_packed>(1).decode(&ops);
+                    send_filtered(it->second, first, ops.begin(), ops.end());
+                    });
+                heartbeat(it->second);
+                }
+
+            return make_cow_tuple(atom("replayed"));
+            },
+        on(atom("request"), arg_match) >> [=](uint64_t id, actor& reply_to,
+                                              any_tuple& query)
+            {
+            send(reply_to, atom("response"), id,
+                 query_result(queries, query));
+            },
+        on(atom("lookup"), arg_match) >> [=](key_type& key)
+            {
+            return lookup_response(store, *stats, key);
             },
         on(atom("haskey"), arg_match) >> [=](key_type& key)
             {
-            bool rval = store.store.find(key) != store.store.end();
-            return make_cow_tuple(rval);
+            return haskey_response(store, *stats, key);
             },
         on(atom("size")) >> [=]()
             {
-            return make_cow_tuple(static_cast<uint64_t>(store.store.size()));
+            return size_response(store, *stats);
             },
         on_arg_match >> [=](down_msg& d)
             {
             auto sender_addr = last_sender();
             demonitor(sender_addr);
             subscribers.erase(sender_addr);
+            partials.erase(sender_addr);
+            streams.erase(sender_addr);
+            counter_set(stats->subscribers,
+                        subscribers.size() + partials.size());
+            },
+        on(atom("heartbeat")) >> [=]()
+            {
+            heartbeat_pending = false;
+
+            for ( auto& p : partials )
+                heartbeat(p.second);
+            },
+        // Diagnostics
+        on(atom("flush"), arg_match) >> [=](uint64_t generation)
+            {
+            // Ignore timers for runs that already went out for being full.
+            if ( generation == pending_generation )
+                flush();
+            },
+        on(atom("probe"), arg_match) >> [=](int64_t due)
+            {
+            stats->probed(due);
+            auto next = now_ns() + probe_interval_ns;
+            delayed_send(this, std::chrono::nanoseconds(probe_interval_ns),
+                         atom("probe"), next);
+            },
+        on(atom("dump")) >> [=]()
+            {
+            dbg_dump(this, idstr(), store);
             }
         );
         }
 
 private:
 
-    void publish(const cppa::any_tuple& msg)
+    static uint64_t make_epoch()
+        {
+        std::random_device rd;
+        std::mt19937_64 gen(rd());
+        uint64_t rval;
+
+        do
+            rval = gen();
+        while ( rval == 0 );
+
+        return rval;
+        }
+
+    // Increments a key, answering with the value it had before, or with an
+    // error, changing nothing, if that or 'by' isn't an 8-byte integer or
+    // the durable log failed.
+    cppa::any_tuple fetch_add(key_type& key, const val_type& by)
+        {
+        using namespace cppa;
+        counter_add(stats->fetch_adds);
+        auto it = store.store.find(key);
+        int64_t previous = 0;
+
+        if ( ! by.is_int() || log_failed() )
+            return make_cow_tuple(atom("error"));
+
+        if ( it != store.store.end() )
+            {
+            if ( ! it->second.is_int() )
+                return make_cow_tuple(atom("error"));
+
+            previous = it->second.as_int();
+            }
+
+        auto start = now_ns();
+        store.increment(key, by.as_int());
+        publish(kv_update{KV_OP_INCREMENT, std::move(key), by});
+        updated(start);
+        return make_cow_tuple(atom("ok"), previous);
+        }
+
+    // Inserts 'desired' if the key holds 'expected', or is missing when
+    // 'expect_present' is false, answering with whether it did, whether
+    // the key was present, and its value, or with an error if the durable
+    // log failed.
+    cppa::any_tuple compare_and_swap(key_type& key, bool expect_present,
+                                     const val_type& expected,
+                                     const val_type& desired)
+        {
+        using namespace cppa;
+        counter_add(stats->compare_swaps);
+
+        if ( log_failed() )
+            return make_cow_tuple(atom("error"));
+
+        auto it = store.store.find(key);
+        bool present = it != store.store.end();
+        val_type previous = present ? it->second : val_type{};
+        bool swapped = present == expect_present &&
+                       (! present || previous == expected);
+
+        if ( swapped )
+            {
+            auto start = now_ns();
+            store.update(key, desired);
+            untimed(key);
+            publish(kv_update{KV_OP_INSERT, std::move(key), desired});
+            updated(start);
+            }
+
+        return make_cow_tuple(swapped, present, previous);
+        }
+
+    uint64_t now_tick() const
+        { return now_ns() / tick_ns; }
+
+    // Gives a key a TTL running out at 'tick'.  A key keeps a single timer
+    // while its deadline only moves later, as when a session is refreshed:
+    // the timer is rescheduled to the deadline when it comes due.  Only a
+    // deadline brought forward schedules another, leaving the old one to
+    // be ignored.
+    void expire_at(const key_type& key, uint64_t tick)
+        {
+        auto it = deadlines.find(key);
+
+        // The wheel has been idle since the last TTL, if any, went away.
+        expiries.catch_up(now_tick());
+
+        if ( it == deadlines.end() )
+            it = deadlines.emplace(key, deadline{tick, 0}).first;
+
+        it->second.tick = tick;
+
+        if ( ! it->second.timer || tick < it->second.timer )
+            {
+            it->second.timer = tick;
+            expiries.schedule(tick, key);
+            }
+
+        counter_set(stats->ttl_keys, deadlines.size());
+
+        if ( ! expire_pending )
+            schedule_expiry();
+        }
+
+    // Drops any TTL a key has, its timer then being ignored.
+    void untimed(const key_type& key)
+        {
+        if ( deadlines.empty() || ! deadlines.erase(key) )
+            return;
+
+        // Nothing left for the timers still pending to expire.
+        if ( deadlines.empty() )
+            expiries.clear();
+
+        counter_set(stats->ttl_keys, deadlines.size());
+        }
+
+    void untimed_all()
+        {
+        deadlines.clear();
+        expiries.clear();
+        counter_set(stats->ttl_keys, 0);
+        }
+
+    void schedule_expiry()
+        {
+        using namespace cppa;
+        expire_pending = true;
+        delayed_send(this, std::chrono::nanoseconds(tick_ns), atom("expire"));
+        }
+
+    // Removes the keys whose TTLs have run out since the last tick, and
+    // publishes their removal as runs of expirations.
+    void expire()
+        {
+        auto start = now_ns();
+        kv_batch expired;
+
+        expiries.advance(now_tick(), [&](uint64_t tick, key_type& key)
+            {
+            auto it = deadlines.find(key);
+
+            // Superseded by another timer, or the TTL was dropped.
+            if ( it == deadlines.end() || it->second.timer != tick )
+                return;
+
+            if ( it->second.tick > tick )
+                {
+                it->second.timer = it->second.tick;
+                expiries.schedule(it->second.tick, std::move(key));
+                return;
+                }
+
+            deadlines.erase(it);
+            expired.push_back({KV_OP_EXPIRE, std::move(key), val_type{}});
+            });
+
+        if ( expired.empty() )
+            return;
+
+        counter_set(stats->ttl_keys, deadlines.size());
+        size_t run = std::max(flush_ops, size_t(1));
+
+        for ( size_t i = 0; i < expired.size(); i += run )
+            {
+            auto begin = expired.begin() + i;
+            auto end = expired.begin() + std::min(i + run, expired.size());
+            kv_sequence first = store.nextseq();
+
+            for ( auto it = begin; it != end; ++it )
+                store.apply(*it);
+
+            counter_add(stats->expirations, end - begin);
+            publish(first, kv_batch(std::make_move_iterator(begin),
+                                    std::make_move_iterator(end)));
+            }
+
+        updated(start);
+        }
+
+    // Subscribes a cloner to the updates to the keys passing 'filter'.
+    // Subscribing again, as for another snapshot, starts its stream afresh.
+    void subscribe(const cppa::actor_addr& addr, const cppa::actor& sender,
+                   const kv_filter& filter)
+        {
+        if ( ! subscribers.erase(addr) && ! partials.erase(addr) )
+            monitor(addr);
+
+        if ( filter.all() )
+            subscribers[addr] = sender;
+        else
+            {
+            auto& p = partials[addr];
+            p.sender = sender;
+            p.filter = filter;
+            }
+
+        counter_set(stats->subscribers, subscribers.size() + partials.size());
+        }
+
+    void updated(int64_t start)
+        {
+        counter_set(stats->keys, store.store.size());
+        counter_set(stats->memory, store.memory_usage());
+        stats->update_latency.record(now_ns() - start);
+        }
+
+    // Publishes an update that was just applied to the store.
+    void publish(kv_update u)
+        {
+        if ( wal )
+            logged(store.sequence, u);
+
+        if ( flush_us )
+            {
+            if ( pending.empty() )
+                coalesce_start(store.sequence);
+
+            pending_bytes += u.key.size() + u.val.size();
+            pending.push_back(std::move(u));
+            coalesce_check();
+            }
+        else
+            send_update(store.sequence, &u, &u + 1);
+        }
+
+    // Publishes a batch that was just applied starting at sequence 'first'.
+    void publish(const kv_sequence& first, const kv_batch& ops)
+        {
+        if ( wal )
+            {
+            auto seq = first;
+
+            for ( const auto& u : ops )
+                logged(seq++, u);
+            }
+
+        if ( flush_us )
+            {
+            if ( pending.empty() )
+                coalesce_start(first);
+
+            for ( const auto& u : ops )
+                {
+                pending_bytes += u.key.size() + u.val.size();
+                pending.push_back(u);
+                }
+
+            coalesce_check();
+            }
+        else
+            send_update(first, ops.begin(), ops.end());
+        }
+
+    // Whether updates are refused because the durable log stopped taking
+    // them: they would be published, then lost when the master restarts.
+    bool log_failed()
         {
+        using namespace cppa;
+
+        if ( ! wal || ! wal->failed() )
+            return false;
+
+        if ( ! log_failure_reported )
+            {
+            aout(this) << "ERROR: " << idstr() << " write-ahead log failed, "
+                       << "refusing updates." << std::endl;
+            log_failure_reported = true;
+            }
+
+        return true;
+        }
+
+    // Writes an update to the durable log, and starts compacting the log
+    // into a new snapshot once it has grown enough.
+    void logged(const kv_sequence& seq, const kv_update& u)
+        {
+        using namespace cppa;
+        wal->append(seq, u);
+
+        if ( ! wal->compaction_due() )
+            return;
+
+        try
+            {
+            wal->begin_snapshot(seq);
+            }
+        catch ( std::exception& e )
+            {
+            aout(this) << "ERROR: " << idstr() << " can't start snapshot: "
+                       << e.what() << std::endl;
+            return;
+            }
+
+        send(this, atom("compact"), false, key_type{});
+        }
+
+    void coalesce_start(const kv_sequence& first)
+        {
+        using namespace cppa;
+        pending_first = first;
+        delayed_send(this, std::chrono::microseconds(flush_us), atom("flush"),
+                     ++pending_generation);
+        }
+
+    void coalesce_check()
+        {
+        if ( pending.size() >= flush_ops || pending_bytes >= flush_bytes )
+            flush();
+        }
+
+    // Sends any coalesced updates as one contiguous batch.
+    void flush()
+        {
+        if ( pending.empty() )
+            return;
+
+        counter_add(stats->publish_flushes);
+        stats->publish_batch_ops.record(pending.size());
+        send_update(pending_first, pending.begin(), pending.end());
+        pending.clear();
+        pending_bytes = 0;
+        ++pending_generation;
+        }
+
+    template <typename It>
+    void send_update(const kv_sequence& first, It begin, It end)
+        {
+        auto msg = packed_msg(first, begin, end);
+        log.append(first, msg);
         for ( auto s : subscribers ) send_tuple(s.second, msg);
+
+        for ( auto& p : partials )
+            send_filtered(p.second, first, begin, end);
+        }
+
+    // A subscriber replicating only some keys.  Updates to others are left
+    // out of its stream, and it's told how many it skipped along with the
+    // next update it does get, or else by a heartbeat: a run of just the
+    // skip, sent once the skips have been held for heartbeat_ms.
+    struct partial {
+        cppa::actor sender;
+        kv_filter filter;
+        kv_sequence skip_first;
+        uint64_t skipped = 0;
+    };
+
+    static kv_update skip(uint64_t n)
+        { return kv_update{KV_OP_SKIP, key_type{}, kv_value::from_int(n)}; }
+
+    // Sends a partial subscriber the updates in a run that affect it, if
+    // any, with the others in between as skips.
+    template <typename It>
+    void send_filtered(partial& p, const kv_sequence& first, It begin, It end)
+        {
+        using namespace cppa;
+
+        if ( ! p.skipped )
+            p.skip_first = first;
+
+        auto start = p.skip_first;
+        kv_batch ops;
+
+        for ( auto it = begin; it != end; ++it )
+            {
+            if ( ! p.filter.covers(*it) )
+                {
+                ++p.skipped;
+                counter_add(stats->filtered_updates);
+                continue;
+                }
+
+            if ( p.skipped )
+                ops.push_back(skip(p.skipped));
+
+            p.skipped = 0;
+            ops.push_back(*it);
+            }
+
+        if ( ops.empty() )
+            {
+            if ( ! heartbeat_ms )
+                heartbeat(p);
+            else if ( ! heartbeat_pending )
+                {
+                heartbeat_pending = true;
+                delayed_send(this, std::chrono::milliseconds(heartbeat_ms),
+                             atom("heartbeat"));
+                }
+
+            return;
+            }
+
+        // Ending on the run's last sequence, as replays are started from.
+        if ( p.skipped )
+            ops.push_back(skip(p.skipped));
+
+        p.skipped = 0;
+        send_tuple(p.sender, packed_msg(start, ops.begin(), ops.end()));
+        }
+
+    void heartbeat(partial& p)
+        {
+        if ( ! p.skipped )
+            return;
+
+        auto u = skip(p.skipped);
+        p.skipped = 0;
+        send_tuple(p.sender, packed_msg(p.skip_first, &u, &u + 1));
         }
 
     std::string idstr() const
@@ -125,8 +801,52 @@ private:
         return ss.str();
         }
 
+    // Identifies this master's update history; cloners may only replay
+    // from a log whose epoch matches the one they last synchronized with.
+    uint64_t epoch;
     kv_store store;
+    replay_log log;
+    size_t chunk_bytes;
+    // ACLONE_SNAPSHOT_* codecs snapshots may be sent in.
+    uint32_t codecs;
+    // Coalescing of published updates; disabled when flush_us is zero.
+    uint32_t flush_us;
+    size_t flush_ops;
+    size_t flush_bytes;
+    // How long skips may be held for partial subscribers.
+    uint32_t heartbeat_ms;
+    bool heartbeat_pending = false;
+    kv_sequence pending_first;
+    kv_batch pending;
+    size_t pending_bytes = 0;
+    uint64_t pending_generation = 0;
+    // Keys with a TTL, by the tick it runs out at, and the timers that
+    // expire them.  Each key's deadline also records which of the timers
+    // scheduled for it is current.
+    int64_t tick_ns;
+    struct deadline {
+        uint64_t tick;
+        uint64_t timer;
+    };
+
+    std::unordered_map<key_type, deadline> deadlines;
+    timer_wheel<key_type> expiries;
+    bool expire_pending = false;
+    std::shared_ptr<store_stats> stats;
+    // Null unless the master is durable.
+    std::shared_ptr<durable_log> wal;
+    bool log_failure_reported = false;
     std::unordered_map<cppa::actor_addr, cppa::actor> subscribers;
+    std::unordered_map<cppa::actor_addr, partial> partials;
+    // The snapshot stream in progress to each subscriber.
+    struct stream {
+        uint64_t id = 0;
+        uint32_t codecs = 0;
+        kv_filter filter;
+    };
+
+    std::unordered_map<cppa::actor_addr, stream> streams;
+    cppa::partial_function queries;
     cppa::behavior serving;
     cppa::behavior& init_state = serving;
 };
@@ -0,0 +1,60 @@
+#ifndef ACLONE_PEERS_HPP
+#define ACLONE_PEERS_HPP
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <cstdint>
+#include <cppa/cppa.hpp>
+
+namespace aclone {
+
+// An "addr:port" a front-end may be published on.
+using endpoint = std::pair<std::string, uint16_t>;
+
+// Front-ends connected to from a context, shared by all of its remote
+// handles and cloners, so a peer is reached over one connection no matter
+// how many topics and shards are used from it.
+class peer_cache {
+public:
+
+    // Throws like cppa::remote_actor() if a new connection fails.  The
+    // lock isn't held while connecting, so an unreachable peer only holds
+    // up its own callers; if two connect at once, the first one kept wins.
+    cppa::actor connect(const std::string& addr, uint16_t port)
+        {
+        auto key = endpoint(addr, port);
+
+            {
+            std::lock_guard<std::mutex> guard{mtx};
+            auto it = peers.find(key);
+
+            if ( it != peers.end() )
+                return it->second;
+            }
+
+        auto rval = cppa::remote_actor(addr, port);
+        std::lock_guard<std::mutex> guard{mtx};
+        return peers.emplace(key, rval).first->second;
+        }
+
+    // Forgets a connection that was lost, unless it was already replaced.
+    void drop(const std::string& addr, uint16_t port, const cppa::actor& a)
+        {
+        std::lock_guard<std::mutex> guard{mtx};
+        auto it = peers.find(endpoint(addr, port));
+
+        if ( it != peers.end() && it->second == a )
+            peers.erase(it);
+        }
+
+private:
+
+    std::mutex mtx;
+    std::map<endpoint, cppa::actor> peers;
+};
+
+} // namespace aclone
+
+#endif // ACLONE_PEERS_HPP
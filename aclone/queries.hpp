@@ -0,0 +1,160 @@
+#ifndef ACLONE_QUERIES_HPP
+#define ACLONE_QUERIES_HPP
+
+#include <cstdint>
+#include <algorithm>
+#include <cppa/cppa.hpp>
+
+#include "kv_store.hpp"
+#include "stats.hpp"
+
+namespace aclone {
+
+// Responses to the queries both master and cloner stores answer.
+
+inline cppa::any_tuple lookup_response(const kv_store& store,
+                                       store_stats& stats,
+                                       const key_type& key)
+    {
+    using namespace cppa;
+    counter_add(stats.lookups);
+    auto it = store.store.find(key);
+
+    if ( it == store.store.end() )
+        return make_cow_tuple(atom("null"), val_type{});
+    else
+        return make_cow_tuple(atom("ok"), it->second);
+    }
+
+inline cppa::any_tuple haskey_response(const kv_store& store,
+                                       store_stats& stats,
+                                       const key_type& key)
+    {
+    using namespace cppa;
+    counter_add(stats.haskeys);
+    return make_cow_tuple(store.store.find(key) != store.store.end());
+    }
+
+// Multi-key queries resolve every key in one invocation and answer with
+// vectors parallel to the requested keys.
+inline cppa::any_tuple lookup_multi_response(const kv_store& store,
+                                             store_stats& stats,
+                                             const kv_keys& keys)
+    {
+    using namespace cppa;
+    counter_add(stats.lookups, keys.size());
+    std::vector<uint8_t> found(keys.size(), 0);
+    std::vector<val_type> vals(keys.size());
+
+    for ( size_t i = 0; i < keys.size(); ++i )
+        {
+        auto it = store.store.find(keys[i]);
+
+        if ( it == store.store.end() )
+            continue;
+
+        found[i] = 1;
+        vals[i] = it->second;
+        }
+
+    return make_cow_tuple(std::move(found), std::move(vals));
+    }
+
+inline cppa::any_tuple haskey_multi_response(const kv_store& store,
+                                             store_stats& stats,
+                                             const kv_keys& keys)
+    {
+    using namespace cppa;
+    counter_add(stats.haskeys, keys.size());
+    std::vector<uint8_t> found;
+    found.reserve(keys.size());
+
+    for ( const auto& key : keys )
+        found.push_back(store.store.find(key) != store.store.end());
+
+    return make_cow_tuple(std::move(found));
+    }
+
+inline cppa::any_tuple size_response(const kv_store& store,
+                                     store_stats& stats)
+    {
+    using namespace cppa;
+    counter_add(stats.sizes);
+    return make_cow_tuple(static_cast<uint64_t>(store.store.size()));
+    }
+
+// Largest page of keys a store hands out per request, regardless of what
+// the cursor asked for, so one scan message never occupies the actor long.
+constexpr uint64_t keys_page_max = 16384;
+
+// One page of the keys with the given prefix, starting just past 'after' if
+// resuming (an O(log n) seek, since the store is ordered) or at the prefix
+// otherwise.  Answers with the keys, their values if requested, and whether
+// the scan is complete.
+inline cppa::any_tuple keys_response(const kv_store& store,
+                                     store_stats& stats,
+                                     const key_type& prefix,
+                                     const key_type& after, bool resume,
+                                     uint64_t limit, bool with_values)
+    {
+    using namespace cppa;
+    counter_add(stats.key_pages);
+    limit = std::min(std::max(limit, uint64_t(1)), keys_page_max);
+    auto it = resume ? store.store.upper_bound(after)
+                     : store.store.lower_bound(prefix);
+    kv_keys keys;
+    std::vector<val_type> vals;
+    bool done = true;
+
+    for ( ; it != store.store.end(); ++it )
+        {
+        if ( ! it->first.starts_with(prefix) )
+            break;
+
+        if ( keys.size() == limit )
+            {
+            done = false;
+            break;
+            }
+
+        keys.push_back(it->first.str());
+
+        if ( with_values )
+            vals.push_back(it->second);
+        }
+
+    return make_cow_tuple(std::move(keys), std::move(vals), done);
+    }
+
+// Whether a query is a read-modify-write, which only a master may answer.
+inline bool is_update_query(const cppa::any_tuple& query)
+    {
+    using namespace cppa;
+    auto fetch_add = tuple_cast<atom_value, key_type, val_type>(query);
+
+    if ( fetch_add.valid() )
+        return get<0>(*fetch_add) == atom("fetch_add");
+
+    auto cas = tuple_cast<atom_value, key_type, bool, val_type,
+                          val_type>(query);
+    return cas.valid() && get<0>(*cas) == atom("cas");
+    }
+
+// Evaluates a query carried in a ("request", id, reply_to, query) envelope,
+// which the store answers with ("response", id, result).  Unlike sync_send,
+// any number of these can be in flight from one requester at a time.
+inline cppa::any_tuple query_result(cppa::partial_function& queries,
+                                    cppa::any_tuple& query)
+    {
+    using namespace cppa;
+    auto result = queries(query);
+
+    if ( result )
+        return *result;
+
+    return make_cow_tuple(atom("error"));
+    }
+
+} // namespace aclone
+
+#endif // ACLONE_QUERIES_HPP
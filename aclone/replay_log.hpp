@@ -0,0 +1,79 @@
+#ifndef ACLONE_REPLAY_LOG_HPP
+#define ACLONE_REPLAY_LOG_HPP
+
+#include <deque>
+#include <cstddef>
+#include <algorithm>
+#include <cppa/cppa.hpp>
+
+#include "kv_sequence.hpp"
+
+namespace aclone {
+
+// Bounded log of the most recently published update messages, keyed by the
+// first sequence number each one covers (a batch covers several).  Once
+// full, appending discards the oldest entry.
+class replay_log {
+public:
+
+    struct entry {
+        kv_sequence seq;
+        cppa::any_tuple msg;
+    };
+
+    explicit replay_log(size_t capacity = 0)
+        : capacity(capacity)
+        {}
+
+    void append(const kv_sequence& seq, const cppa::any_tuple& msg)
+        {
+        if ( capacity == 0 )
+            return;
+
+        if ( entries.size() == capacity )
+            entries.pop_front();
+
+        entries.push_back(entry{seq, msg});
+        }
+
+    // Whether every update after 'since' up to 'current' is still available.
+    bool covers(const kv_sequence& since, const kv_sequence& current) const
+        {
+        if ( since == current )
+            return true;
+
+        if ( since > current || entries.empty() )
+            return false;
+
+        return entries.front().seq <= since.next();
+        }
+
+    // Calls f(msg) for each logged update published after 'since', in order.
+    // Stores only ever stop at the end of a batch, so any entry starting
+    // after 'since' lies wholly after it.
+    template <typename F>
+    void replay(const kv_sequence& since, F f) const
+        {
+        auto it = std::upper_bound(entries.begin(), entries.end(), since,
+                                   [](const kv_sequence& s, const entry& e)
+                                       { return s < e.seq; });
+
+        for ( ; it != entries.end(); ++it )
+            f(it->msg);
+        }
+
+    void clear()
+        { entries.clear(); }
+
+    size_t size() const
+        { return entries.size(); }
+
+private:
+
+    size_t capacity;
+    std::deque<entry> entries;
+};
+
+} // namespace aclone
+
+#endif // ACLONE_REPLAY_LOG_HPP
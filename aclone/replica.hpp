@@ -0,0 +1,311 @@
+#ifndef ACLONE_REPLICA_HPP
+#define ACLONE_REPLICA_HPP
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+
+#include "kv_store.hpp"
+#include "epoch.hpp"
+#include "store_file.hpp"
+
+namespace aclone {
+
+// A copy of a cloner's store that any thread can read without locks or
+// messages.  The cloner actor is the only writer: it mirrors every change
+// to its kv_store here by publishing new immutable nodes, and retires the
+// ones they replace through epoch-based reclamation.  Reads only succeed
+// while the cloner is synchronized with its master, or serving a copy of
+// the store it persisted earlier; otherwise callers fall back to asking the
+// actor, as before.
+class replica {
+public:
+
+    replica()
+        : table(new bucket_table(initial_buckets))
+        {}
+
+    ~replica()
+        {
+        delete table.load(std::memory_order_relaxed);
+        }
+
+    replica(const replica&) = delete;
+    replica& operator=(const replica&) = delete;
+
+    // Reader side.  Each returns false if the replica can't answer.
+
+    bool lookup(const key_type& key, bool* found, val_type* val) const
+        {
+        epoch_domain::guard guard;
+
+        if ( ! guard.valid() || ! ready.load(std::memory_order_acquire) )
+            return false;
+
+        if ( auto f = preloaded.load(std::memory_order_acquire) )
+            {
+            *found = f->find(key, val);
+            return true;
+            }
+
+        auto n = find(key);
+        *found = n;
+
+        if ( n )
+            *val = n->val;
+
+        return true;
+        }
+
+    bool haskey(const key_type& key, bool* found) const
+        {
+        epoch_domain::guard guard;
+
+        if ( ! guard.valid() || ! ready.load(std::memory_order_acquire) )
+            return false;
+
+        if ( auto f = preloaded.load(std::memory_order_acquire) )
+            *found = f->find(key, nullptr);
+        else
+            *found = find(key);
+
+        return true;
+        }
+
+    bool size(uint64_t* rval) const
+        {
+        epoch_domain::guard guard;
+
+        if ( ! guard.valid() || ! ready.load(std::memory_order_acquire) )
+            return false;
+
+        if ( auto f = preloaded.load(std::memory_order_acquire) )
+            *rval = f->size();
+        else
+            *rval = count.load(std::memory_order_relaxed);
+
+        return true;
+        }
+
+    // Writer side, only ever called by the owning cloner actor (or before
+    // it's spawned).
+
+    void set_ready(bool arg_ready)
+        {
+        ready.store(arg_ready, std::memory_order_release);
+        }
+
+    // Answers reads straight from a persisted store file until the next
+    // reset(), e.g. while the cloner is still loading that same file.
+    void preload(std::shared_ptr<const store_file> f)
+        {
+        file = std::move(f);
+        preloaded.store(file.get(), std::memory_order_release);
+        set_ready(true);
+        }
+
+    // Mirrors an update the cloner just applied to 'store'.
+    void applied(const kv_update& u, const kv_store& store)
+        {
+        if ( u.op == KV_OP_CLEAR )
+            {
+            reset({});
+            return;
+            }
+
+        auto it = store.store.find(u.key);
+
+        if ( it == store.store.end() )
+            erase(u.key);
+        else
+            put(it->first.str(), it->second);
+        }
+
+    // Replaces the contents with those of 'store'.
+    void reset(const kv_store& store)
+        {
+        size_t buckets = initial_buckets;
+
+        while ( buckets < store.store.size() )
+            buckets *= 2;
+
+        auto t = new bucket_table(buckets);
+
+        for ( const auto& kv : store.store )
+            t->push(new node(kv.first.str(), kv.second));
+
+        swap_table(t, store.store.size());
+
+        if ( file )
+            {
+            auto f = std::move(file);
+            preloaded.store(nullptr, std::memory_order_release);
+            reclaim.retire([f]() mutable { f.reset(); });
+            }
+        }
+
+private:
+
+    static const size_t initial_buckets = 64;
+
+    struct node {
+        node(const key_type& k, const val_type& v)
+            : hash(std::hash<key_type>()(k)), key(k), val(v)
+            { next.store(nullptr, std::memory_order_relaxed); }
+
+        size_t hash;
+        key_type key;
+        val_type val;
+        std::atomic<node*> next;
+    };
+
+    struct bucket_table {
+        explicit bucket_table(size_t n)
+            : mask(n - 1), buckets(new std::atomic<node*>[n])
+            {
+            for ( size_t i = 0; i < n; ++i )
+                buckets[i].store(nullptr, std::memory_order_relaxed);
+            }
+
+        // Frees all nodes still linked in, which nobody else owns.
+        ~bucket_table()
+            {
+            for ( size_t i = 0; i <= mask; ++i )
+                {
+                auto n = buckets[i].load(std::memory_order_relaxed);
+
+                while ( n )
+                    {
+                    auto next = n->next.load(std::memory_order_relaxed);
+                    delete n;
+                    n = next;
+                    }
+                }
+            }
+
+        std::atomic<node*>& bucket(size_t hash)
+            { return buckets[hash & mask]; }
+
+        // Only for tables not yet visible to readers.
+        void push(node* n)
+            {
+            auto& b = bucket(n->hash);
+            n->next.store(b.load(std::memory_order_relaxed),
+                          std::memory_order_relaxed);
+            b.store(n, std::memory_order_relaxed);
+            }
+
+        size_t mask;
+        std::unique_ptr<std::atomic<node*>[]> buckets;
+    };
+
+    const node* find(const key_type& key) const
+        {
+        auto h = std::hash<key_type>()(key);
+        auto t = table.load(std::memory_order_acquire);
+        auto n = t->bucket(h).load(std::memory_order_acquire);
+
+        for ( ; n; n = n->next.load(std::memory_order_acquire) )
+            if ( n->hash == h && n->key == key )
+                return n;
+
+        return nullptr;
+        }
+
+    void put(const key_type& key, const val_type& val)
+        {
+        auto t = table.load(std::memory_order_relaxed);
+        auto fresh = new node(key, val);
+        auto link = &t->bucket(fresh->hash);
+
+        for ( auto n = link->load(std::memory_order_relaxed); n;
+              n = n->next.load(std::memory_order_relaxed) )
+            {
+            if ( n->hash == fresh->hash && n->key == key )
+                {
+                // Readers see either the old node or its replacement.
+                fresh->next.store(n->next.load(std::memory_order_relaxed),
+                                  std::memory_order_relaxed);
+                link->store(fresh, std::memory_order_release);
+                retire(n);
+                return;
+                }
+
+            link = &n->next;
+            }
+
+        auto& b = t->bucket(fresh->hash);
+        fresh->next.store(b.load(std::memory_order_relaxed),
+                          std::memory_order_relaxed);
+        b.store(fresh, std::memory_order_release);
+        auto n = count.load(std::memory_order_relaxed) + 1;
+        count.store(n, std::memory_order_relaxed);
+
+        if ( n > t->mask + 1 )
+            grow();
+        }
+
+    void erase(const key_type& key)
+        {
+        auto h = std::hash<key_type>()(key);
+        auto t = table.load(std::memory_order_relaxed);
+        auto link = &t->bucket(h);
+
+        for ( auto n = link->load(std::memory_order_relaxed); n;
+              n = n->next.load(std::memory_order_relaxed) )
+            {
+            if ( n->hash == h && n->key == key )
+                {
+                link->store(n->next.load(std::memory_order_relaxed),
+                            std::memory_order_release);
+                retire(n);
+                count.store(count.load(std::memory_order_relaxed) - 1,
+                            std::memory_order_relaxed);
+                return;
+                }
+
+            link = &n->next;
+            }
+        }
+
+    // Rehashes copies of every node into a table twice the size, since
+    // readers may still be walking the old chains.
+    void grow()
+        {
+        auto old = table.load(std::memory_order_relaxed);
+        auto t = new bucket_table(2 * (old->mask + 1));
+
+        for ( size_t i = 0; i <= old->mask; ++i )
+            for ( auto n = old->buckets[i].load(std::memory_order_relaxed); n;
+                  n = n->next.load(std::memory_order_relaxed) )
+                t->push(new node(n->key, n->val));
+
+        swap_table(t, count.load(std::memory_order_relaxed));
+        }
+
+    void swap_table(bucket_table* t, size_t n)
+        {
+        auto old = table.load(std::memory_order_relaxed);
+        table.store(t, std::memory_order_release);
+        count.store(n, std::memory_order_relaxed);
+        reclaim.retire([old]() { delete old; });
+        }
+
+    void retire(node* n)
+        {
+        reclaim.retire([n]() { delete n; });
+        }
+
+    std::atomic<bucket_table*> table;
+    std::atomic<uint64_t> count{0};
+    std::atomic<bool> ready{false};
+    std::atomic<const store_file*> preloaded{nullptr};
+    std::shared_ptr<const store_file> file;
+    reclaimer reclaim;
+};
+
+} // namespace aclone
+
+#endif // ACLONE_REPLICA_HPP
@@ -3,139 +3,123 @@
 
 #include <string>
 #include <mutex>
-#include <condition_variable>
+#include <memory>
 #include <functional>
+#include <unordered_map>
 #include <cppa/cppa.hpp>
 
 #include "aclone/aclone.h"
 
 namespace aclone {
 
-class sync_requester : public cppa::sb_actor<sync_requester> {
-friend class cppa::sb_actor<sync_requester>;
+// Completion of an in-flight request; invoked exactly once.
+using request_cb = std::function<void (aclone_async_result,
+                                       const cppa::any_tuple&)>;
 
+// Requests a store handle has in flight, keyed by correlation id.  Shared
+// between the threads issuing requests and the handle's request_channel.
+class request_table {
 public:
 
-    sync_requester(const cppa::actor& store, std::mutex& mtx,
-                   std::condition_variable& cv, int& flag,
-                   const cppa::any_tuple& request, cppa::any_tuple& response)
+    // Returns the new request's id, or zero if the store is gone.
+    uint64_t add(request_cb cb)
         {
-        using namespace cppa;
-        using namespace std;
-        monitor(store);
-        on_sync_failure(
-            [=]() { send(this, atom("quit"), false); });
-        bootstrap = (
-        after(std::chrono::seconds(0)) >> [=]()
-            {
-            become(requesting);
-            send(this, atom("request"));
-            }
-        );
-        requesting = (
-        on(atom("request")) >> [=, &response]()
-            {
-            if ( store->exit_reason() == exit_reason::not_exited )
-                {
-                sync_send_tuple(store, request).then(
-                    on_arg_match >> [=](down_msg& d)
-                        {
-                        send(this, atom("quit"), false);
-                        },
-                    others() >> [=, &response]()
-                        {
-                        response = last_dequeued();
-                        send(this, atom("quit"), true);
-                        }
-                );
-                }
-            else
-                {
-                send(this, atom("quit"), false);
-                }
-            },
-        on(atom("quit"), arg_match) >> [=, &flag, &mtx, &cv](bool rval)
+        std::lock_guard<std::mutex> guard{mtx};
+
+        if ( closed )
+            return 0;
+
+        auto id = ++last_id;
+        pending.emplace(id, std::move(cb));
+        return id;
+        }
+
+    // Removes and returns a request's completion, if still pending.
+    request_cb take(uint64_t id)
+        {
+        std::lock_guard<std::mutex> guard{mtx};
+        auto it = pending.find(id);
+
+        if ( it == pending.end() )
+            return {};
+
+        auto rval = std::move(it->second);
+        pending.erase(it);
+        return rval;
+        }
+
+    // Fails everything pending and refuses new requests.
+    void close()
+        {
+        std::unordered_map<uint64_t, request_cb> failed;
+
             {
-            flag = rval ? 1 : 0;
-            unique_lock<mutex> guard{mtx};
-            cv.notify_all();
-            quit();
+            std::lock_guard<std::mutex> guard{mtx};
+            closed = true;
+            failed.swap(pending);
             }
-        );
+
+        for ( auto& p : failed )
+            p.second(ACLONE_ASYNC_FAILURE, {});
         }
 
 private:
 
-    cppa::behavior bootstrap;
-    cppa::behavior requesting;
-    cppa::behavior& init_state = bootstrap;
+    std::mutex mtx;
+    bool closed = false;
+    uint64_t last_id = 0;
+    std::unordered_map<uint64_t, request_cb> pending;
 };
 
-class async_requester : public cppa::sb_actor<async_requester> {
-friend class cppa::sb_actor<async_requester>;
-using async_cb = std::function<void (aclone_async_result,
-                                     const cppa::any_tuple&)>;
+// Long-lived actor that receives the responses to every request made through
+// one store handle.  Callers send ("request", id, channel, query) straight
+// to the store and register a completion in the request_table; many
+// requests may be in flight at once.  A ("deadline", id, microseconds)
+// message makes the channel time the request out.
+class request_channel : public cppa::sb_actor<request_channel> {
+friend class cppa::sb_actor<request_channel>;
 
 public:
 
-    async_requester(const cppa::actor& store, const cppa::any_tuple& request,
-                    double timeout, async_cb cb)
+    request_channel(const cppa::actor& store,
+                    std::shared_ptr<request_table> table)
         {
         using namespace cppa;
-        using namespace std;
         monitor(store);
-        on_sync_failure([=]()
+        serving = (
+        on(atom("response"), arg_match) >> [=](uint64_t id,
+                                               const any_tuple& result)
             {
-            cb(ACLONE_ASYNC_FAILURE, {});
-            quit();
-            }
-        );
-        on_sync_timeout([=]()
+            if ( auto cb = table->take(id) )
+                cb(ACLONE_ASYNC_SUCCESS, result);
+            },
+        on(atom("deadline"), arg_match) >> [=](uint64_t id, int64_t timeout_us)
             {
-            cb(ACLONE_ASYNC_TIMEOUT, {});
-            quit();
-            }
-        );
-        bootstrap = (
-        after(std::chrono::seconds(0)) >> [=]()
+            delayed_send(this, std::chrono::microseconds(timeout_us),
+                         atom("timeout"), id);
+            },
+        on(atom("timeout"), arg_match) >> [=](uint64_t id)
             {
-            become(requesting);
-            send(this, atom("request"));
-            }
-        );
-        requesting = (
-        on(atom("request")) >> [=]()
+            if ( auto cb = table->take(id) )
+                cb(ACLONE_ASYNC_TIMEOUT, {});
+            },
+        on(atom("quit")) >> [=]()
             {
-            if ( store->exit_reason() == exit_reason::not_exited )
-                {
-                timed_sync_send_tuple(store, chrono::duration<double>(timeout),
-                                      request).then(
-                    on_arg_match >> [=](down_msg& d)
-                        {
-                        cb(ACLONE_ASYNC_FAILURE, {});
-                        quit();
-                        },
-                    others() >> [=]()
-                        {
-                        cb(ACLONE_ASYNC_SUCCESS, last_dequeued());
-                        quit();
-                        }
-                );
-                }
-            else
-                {
-                cb(ACLONE_ASYNC_FAILURE, {});
-                quit();
-                }
+            table->close();
+            quit();
+            },
+        on_arg_match >> [=](down_msg& d)
+            {
+            table->close();
+            quit();
             }
         );
         }
 
 private:
 
-    cppa::behavior bootstrap;
-    cppa::behavior requesting;
-    cppa::behavior& init_state = bootstrap;
+    cppa::behavior serving;
+    cppa::behavior& init_state = serving;
 };
 
 } // namespace aclone
@@ -0,0 +1,256 @@
+#ifndef ACLONE_SERIALIZATION_HPP
+#define ACLONE_SERIALIZATION_HPP
+
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+#include <cppa/cppa.hpp>
+
+#include "kv_store.hpp"
+#include "snapshot.hpp"
+#include "sharding.hpp"
+#include "wire.hpp"
+#include "chunk_codec.hpp"
+#include "key_filter.hpp"
+
+namespace aclone {
+
+// kv_sequence used to be announced as its std::vector<uint64_t> member,
+// most significant word first, growing only on overflow.  This keeps that
+// exact layout on the wire so older peers interoperate.
+class kv_sequence_type_info
+    : public cppa::util::abstract_uniform_type_info<kv_sequence> {
+
+protected:
+
+    void serialize(const void* ptr, cppa::serializer* sink) const override
+        {
+        auto seq = reinterpret_cast<const kv_sequence*>(ptr);
+        sink->begin_object(name());
+
+        if ( seq->hi )
+            {
+            sink->begin_sequence(2);
+            sink->write_value(seq->hi);
+            }
+        else
+            sink->begin_sequence(1);
+
+        sink->write_value(seq->lo);
+        sink->end_sequence();
+        sink->end_object();
+        }
+
+    void deserialize(void* ptr, cppa::deserializer* source) const override
+        {
+        assert_type_name(source);
+        auto seq = reinterpret_cast<kv_sequence*>(ptr);
+        source->begin_object(name());
+        auto n = source->begin_sequence();
+
+        if ( n > 2 )
+            throw std::runtime_error("kv_sequence wider than 128 bits");
+
+        seq->hi = n == 2 ? source->read<uint64_t>() : 0;
+        seq->lo = n >= 1 ? source->read<uint64_t>() : 0;
+        source->end_sequence();
+        source->end_object();
+        }
+};
+
+// Values go on the wire as their length followed by the raw bytes.
+class kv_value_type_info
+    : public cppa::util::abstract_uniform_type_info<kv_value> {
+
+protected:
+
+    void serialize(const void* ptr, cppa::serializer* sink) const override
+        {
+        auto val = reinterpret_cast<const kv_value*>(ptr);
+        sink->begin_object(name());
+        sink->write_value(static_cast<uint32_t>(val->size()));
+        sink->write_raw(val->size(), val->data());
+        sink->end_object();
+        }
+
+    void deserialize(void* ptr, cppa::deserializer* source) const override
+        {
+        assert_type_name(source);
+        auto val = reinterpret_cast<kv_value*>(ptr);
+        source->begin_object(name());
+        auto size = source->read<uint32_t>();
+
+        if ( size <= kv_value::inline_capacity )
+            {
+            char buf[kv_value::inline_capacity];
+            source->read_raw(size, buf);
+            *val = kv_value(buf, size);
+            }
+        else
+            {
+            std::shared_ptr<char> buf(new char[size],
+                                      std::default_delete<char[]>());
+            source->read_raw(size, buf.get());
+            *val = kv_value(std::move(buf), size);
+            }
+
+        source->end_object();
+        }
+};
+
+// Writes a wire encoding as one length-prefixed run of raw bytes, and
+// reads it back.
+inline void write_wire(cppa::serializer* sink, const char* data, size_t size)
+    {
+    sink->write_value(static_cast<uint32_t>(size));
+    sink->write_raw(size, data);
+    }
+
+inline std::string read_wire(cppa::deserializer* source)
+    {
+    std::string rval(source->read<uint32_t>(), '\0');
+    source->read_raw(rval.size(), &rval[0]);
+    return rval;
+    }
+
+// Messages encoded ahead of sending (published updates, snapshot chunks),
+// which are serialized by copying their bytes.
+template <typename T>
+class packed_type_info : public cppa::util::abstract_uniform_type_info<T> {
+
+protected:
+
+    void serialize(const void* ptr, cppa::serializer* sink) const override
+        {
+        auto packed = reinterpret_cast<const T*>(ptr);
+        sink->begin_object(this->name());
+        write_wire(sink, packed->data(), packed->size());
+        sink->end_object();
+        }
+
+    void deserialize(void* ptr, cppa::deserializer* source) const override
+        {
+        this->assert_type_name(source);
+        auto packed = reinterpret_cast<T*>(ptr);
+        source->begin_object(this->name());
+        *packed = T(read_wire(source));
+        source->end_object();
+        }
+};
+
+// Batches sent to a master: the number of updates, then each update.  Skips
+// are only ever published, so a batch with one is rejected.
+class kv_batch_type_info
+    : public cppa::util::abstract_uniform_type_info<kv_batch> {
+
+protected:
+
+    void serialize(const void* ptr, cppa::serializer* sink) const override
+        {
+        auto ops = reinterpret_cast<const kv_batch*>(ptr);
+        wire_writer w;
+        w.put_varint(ops->size());
+
+        for ( const auto& u : *ops )
+            w.put_update(u);
+
+        sink->begin_object(name());
+        write_wire(sink, w.buffer().data(), w.buffer().size());
+        sink->end_object();
+        }
+
+    void deserialize(void* ptr, cppa::deserializer* source) const override
+        {
+        assert_type_name(source);
+        auto ops = reinterpret_cast<kv_batch*>(ptr);
+        source->begin_object(name());
+        auto bytes = read_wire(source);
+        source->end_object();
+        wire_reader r(bytes.data(), bytes.size());
+        auto n = r.get_varint();
+        ops->clear();
+        ops->reserve(std::min<uint64_t>(n, bytes.size()));
+
+        for ( uint64_t i = 0; i < n; ++i )
+            {
+            ops->push_back(r.get_update());
+
+            if ( ops->back().op == KV_OP_SKIP )
+                throw std::runtime_error("skip in update batch");
+            }
+        }
+};
+
+// Key filters: the number of ranges, then the bounds of each.
+class kv_filter_type_info
+    : public cppa::util::abstract_uniform_type_info<kv_filter> {
+
+protected:
+
+    void serialize(const void* ptr, cppa::serializer* sink) const override
+        {
+        auto filter = reinterpret_cast<const kv_filter*>(ptr);
+        wire_writer w;
+        w.put_varint(filter->key_ranges().size());
+
+        for ( const auto& r : filter->key_ranges() )
+            {
+            w.put_bytes(r.first.data(), r.first.size());
+            w.put_bytes(r.last.data(), r.last.size());
+            }
+
+        sink->begin_object(name());
+        write_wire(sink, w.buffer().data(), w.buffer().size());
+        sink->end_object();
+        }
+
+    void deserialize(void* ptr, cppa::deserializer* source) const override
+        {
+        assert_type_name(source);
+        auto filter = reinterpret_cast<kv_filter*>(ptr);
+        source->begin_object(name());
+        auto bytes = read_wire(source);
+        source->end_object();
+        wire_reader r(bytes.data(), bytes.size());
+        auto n = r.get_varint();
+        *filter = kv_filter{};
+
+        for ( uint64_t i = 0; i < n; ++i )
+            {
+            size_t first_size;
+            size_t last_size;
+            auto first = r.get_bytes(&first_size);
+            auto last = r.get_bytes(&last_size);
+            filter->add_range(key_type(first, first_size),
+                              key_type(last, last_size));
+            }
+        }
+};
+
+inline void announce_types()
+    {
+    using namespace cppa;
+    announce(typeid(kv_sequence), std::unique_ptr<uniform_type_info>{
+             new kv_sequence_type_info});
+    announce(typeid(kv_value), std::unique_ptr<uniform_type_info>{
+             new kv_value_type_info});
+    announce<kv_update>(&kv_update::op, &kv_update::key, &kv_update::val);
+    announce(typeid(kv_batch), std::unique_ptr<uniform_type_info>{
+             new kv_batch_type_info});
+    announce(typeid(kv_packed), std::unique_ptr<uniform_type_info>{
+             new packed_type_info<kv_packed>});
+    announce(typeid(packed_chunk), std::unique_ptr<uniform_type_info>{
+             new packed_type_info<packed_chunk>});
+    announce(typeid(kv_filter), std::unique_ptr<uniform_type_info>{
+             new kv_filter_type_info});
+    announce<kv_keys>();
+    announce<kv_shards>();
+    announce<std::vector<uint8_t>>();
+    announce<std::vector<val_type>>();
+    }
+
+} // namespace aclone
+
+#endif // ACLONE_SERIALIZATION_HPP
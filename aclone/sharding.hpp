@@ -0,0 +1,37 @@
+#ifndef ACLONE_SHARDING_HPP
+#define ACLONE_SHARDING_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <cppa/cppa.hpp>
+
+#include "kv_store.hpp"
+
+namespace aclone {
+
+// The master actors a topic's keys are partitioned across, in shard order.
+using kv_shards = std::vector<cppa::actor>;
+
+// Index of the shard owning 'key'.  Every process routing to a topic must
+// agree on this, so it uses FNV-1a rather than std::hash, which may differ
+// between builds.
+inline size_t shard_of(const key_type& key, size_t shards)
+    {
+    if ( shards <= 1 )
+        return 0;
+
+    uint64_t h = 14695981039346656037ull;
+
+    for ( unsigned char c : key )
+        {
+        h ^= c;
+        h *= 1099511628211ull;
+        }
+
+    return h % shards;
+    }
+
+} // namespace aclone
+
+#endif // ACLONE_SHARDING_HPP
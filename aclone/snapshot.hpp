@@ -0,0 +1,179 @@
+#ifndef ACLONE_SNAPSHOT_HPP
+#define ACLONE_SNAPSHOT_HPP
+
+#include <map>
+#include <vector>
+#include <utility>
+#include <iterator>
+
+#include "kv_store.hpp"
+#include "key_filter.hpp"
+
+namespace aclone {
+
+// One bounded piece of a streamed snapshot.  'entries' is the next run of
+// keys (in order) after the previous chunk, as of sequence 'seq'.
+struct kv_chunk {
+    kv_sequence seq;
+    std::map<key_type, val_type> entries;
+    bool last = false;
+};
+
+inline bool operator==(const kv_chunk& lhs, const kv_chunk& rhs)
+    {
+    return lhs.seq == rhs.seq && lhs.entries == rhs.entries &&
+           lhs.last == rhs.last;
+    }
+
+// Cuts the chunk of about 'max_bytes' that follows key 'after' (or starts
+// the store, if not resuming), as of the store's current sequence.  Only
+// keys passing 'filter' are included, skipping over the others by range.
+inline kv_chunk cut_chunk(const kv_store& store, bool resume,
+                          const key_type& after, size_t max_bytes,
+                          const kv_filter& filter = kv_filter{})
+    {
+    auto kv = resume ? store.store.upper_bound(after) : store.store.begin();
+    size_t bytes = 0;
+    kv_chunk chunk;
+    chunk.seq = store.sequence;
+    kv = filter.seek(store.store, kv);
+
+    while ( kv != store.store.end() &&
+            ( bytes < max_bytes || chunk.entries.empty() ) )
+        {
+        bytes += kv->first.size() + kv->second.size();
+        chunk.entries.emplace_hint(chunk.entries.end(), kv->first.str(),
+                                   kv->second);
+        kv = filter.seek(store.store, ++kv);
+        }
+
+    chunk.last = kv == store.store.end();
+    return chunk;
+    }
+
+// Assembles a streamed snapshot on the receiving side.
+//
+// The master keeps serving updates while it streams, so each chunk reflects
+// the store at the sequence it was cut at, and the live updates published
+// meanwhile are deferred here.  Once the last chunk lands, each deferred
+// update is applied only to the key range of chunks cut before it.
+class snapshot_loader {
+public:
+
+    void start(uint64_t master_epoch, const kv_sequence& seq, uint64_t id)
+        {
+        epoch = master_epoch;
+        stream = id;
+        staged = kv_store{};
+        staged.sequence = seq;
+        chunk_entries = 0;
+        bounds.clear();
+        deferred.clear();
+        }
+
+    void add(kv_chunk& chunk)
+        {
+        for ( auto& kv : chunk.entries )
+            put(kv.first, std::move(kv.second));
+
+        end_chunk(chunk.seq, chunk.last);
+        }
+
+    // Adds a chunk one entry at a time, as when reading it from a file
+    // instead of a kv_chunk, followed by end_chunk().
+    void put(const key_view& key, val_type val)
+        {
+        staged.put(key, std::move(val));
+        ++chunk_entries;
+        }
+
+    void end_chunk(const kv_sequence& seq, bool last)
+        {
+        // Chunks come in key order, so the staged store ends with this one.
+        if ( chunk_entries )
+            bounds[staged.store.rbegin()->first.str()] = seq;
+
+        if ( last )
+            final_seq = seq;
+
+        chunk_entries = 0;
+        }
+
+    // Defers an update published at 'seq', returning the sequence of the
+    // one after it.
+    kv_sequence defer(kv_sequence seq, kv_update u)
+        {
+        auto n = sequences(u);
+        deferred.emplace_back(seq, std::move(u));
+        return seq += n;
+        }
+
+    // Applies deferred updates and moves the assembled store into 'out'.
+    // Returns false if the deferred updates are not contiguous.
+    bool finish(kv_store& out)
+        {
+        for ( auto& d : deferred )
+            {
+            const kv_sequence& seq = d.first;
+            const kv_update& u = d.second;
+
+            if ( seq <= staged.sequence )
+                continue;
+
+            if ( seq != staged.nextseq() )
+                return false;
+
+            if ( u.op == KV_OP_CLEAR )
+                {
+                // Chunks are cut in key order at non-decreasing sequences,
+                // so those predating the clear form a prefix of the keys.
+                auto it = bounds.begin();
+
+                while ( it != bounds.end() && it->second < seq )
+                    ++it;
+
+                if ( it == bounds.end() && final_seq < seq )
+                    staged.erase(staged.store.begin(), staged.store.end());
+                else if ( it != bounds.begin() )
+                    staged.erase(staged.store.begin(),
+                        staged.store.upper_bound(std::prev(it)->first));
+
+                ++staged.sequence;
+                }
+            else if ( u.op == KV_OP_SKIP )
+                staged.apply(u);
+            else if ( seq > chunk_seq(u.key) )
+                staged.apply(u);
+            else
+                ++staged.sequence;
+            }
+
+        out = std::move(staged);
+        out.recount();
+        deferred.clear();
+        bounds.clear();
+        return true;
+        }
+
+    uint64_t epoch = 0;
+    uint64_t stream = 0;
+
+private:
+
+    // Sequence of the chunk whose key range contains 'key'.
+    const kv_sequence& chunk_seq(const key_type& key) const
+        {
+        auto it = bounds.lower_bound(key);
+        return it == bounds.end() ? final_seq : it->second;
+        }
+
+    kv_store staged;
+    size_t chunk_entries = 0;
+    kv_sequence final_seq;
+    std::map<key_type, kv_sequence> bounds;
+    std::vector<std::pair<kv_sequence, kv_update>> deferred;
+};
+
+} // namespace aclone
+
+#endif // ACLONE_SNAPSHOT_HPP
@@ -0,0 +1,243 @@
+#ifndef ACLONE_STATS_HPP
+#define ACLONE_STATS_HPP
+
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+
+#include "aclone/aclone.h"
+#include "kv_store.hpp"
+
+namespace aclone {
+
+// How often store actors measure their own mailbox delay.
+static const int64_t probe_interval_ns = 1000000000;
+
+inline int64_t now_ns()
+    {
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(
+               steady_clock::now().time_since_epoch()).count();
+    }
+
+// CPU time the calling thread has used, for work that runs on one thread
+// from start to end.
+inline int64_t thread_cpu_ns()
+    {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+    }
+
+// Each counter is only ever written by one thread (the owning actor, or a
+// durable master's log writer for its own counters), so they are bumped
+// with plain relaxed loads/stores rather than locked read-modify-write
+// instructions.  Latency histograms are not: any number of application
+// threads record request latencies at once, which is why they use
+// fetch_add.
+inline void counter_add(std::atomic<uint64_t>& counter, uint64_t n = 1)
+    {
+    counter.store(counter.load(std::memory_order_relaxed) + n,
+                  std::memory_order_relaxed);
+    }
+
+inline void counter_set(std::atomic<uint64_t>& counter, uint64_t n)
+    {
+    counter.store(n, std::memory_order_relaxed);
+    }
+
+inline uint64_t counter_get(const std::atomic<uint64_t>& counter)
+    {
+    return counter.load(std::memory_order_relaxed);
+    }
+
+// Bucket i counts samples in [2^i, 2^(i+1)) (nanoseconds, for latencies).
+class latency_histogram {
+public:
+
+    latency_histogram()
+        {
+        for ( auto& b : buckets )
+            b.store(0, std::memory_order_relaxed);
+        }
+
+    void record(int64_t ns)
+        {
+        size_t i = 0;
+        uint64_t v = ns > 0 ? ns : 0;
+
+        while ( v > 1 && i < ACLONE_LATENCY_BUCKETS - 1 )
+            {
+            v >>= 1;
+            ++i;
+            }
+
+        // Recorded from many threads at once; see counter_add().
+        buckets[i].fetch_add(1, std::memory_order_relaxed);
+        }
+
+    void add_to(aclone_histogram* out) const
+        {
+        for ( size_t i = 0; i < ACLONE_LATENCY_BUCKETS; ++i )
+            out->buckets[i] += counter_get(buckets[i]);
+        }
+
+private:
+
+    std::atomic<uint64_t> buckets[ACLONE_LATENCY_BUCKETS];
+};
+
+// Instrumentation shared between a store handle and the actor serving it.
+struct store_stats {
+
+    store_stats()
+        {
+        for ( auto c : { &inserts, &increments, &decrements, &removes,
+                         &clears, &lookups, &haskeys, &sizes, &fetch_adds,
+                         &compare_swaps, &snapshots, &replays, &keys,
+                         &memory, &subscribers, &mailbox_depth,
+                         &mailbox_delay_ns,
+                         &publish_flushes, &key_pages, &wal_commits,
+                         &wal_bytes, &compactions, &snapshot_bytes,
+                         &snapshot_wire_bytes, &snapshot_codec_ns,
+                         &expirations, &ttl_keys, &filtered_updates } )
+            c->store(0, std::memory_order_relaxed);
+        }
+
+    std::atomic<uint64_t>& updates(uint8_t op)
+        {
+        switch ( op ) {
+        case KV_OP_INCREMENT:
+            return increments;
+        case KV_OP_DECREMENT:
+            return decrements;
+        case KV_OP_REMOVE:
+            return removes;
+        case KV_OP_CLEAR:
+            return clears;
+        case KV_OP_EXPIRE:
+            return expirations;
+        default:
+            return inserts;
+        }
+        }
+
+    uint64_t handled() const
+        {
+        uint64_t rval = 0;
+
+        for ( auto c : { &inserts, &increments, &decrements, &removes,
+                         &clears, &lookups, &haskeys, &sizes, &fetch_adds,
+                         &compare_swaps, &snapshots, &replays,
+                         &key_pages } )
+            rval += counter_get(*c);
+
+        return rval;
+        }
+
+    // Called when a mailbox probe scheduled for time 'due' is dequeued.
+    // The delay is measured directly; the depth is estimated from it and
+    // the rate messages were handled at since the previous probe.
+    void probed(int64_t due)
+        {
+        int64_t now = now_ns();
+        int64_t delay = now > due ? now - due : 0;
+        uint64_t total = handled();
+
+        if ( last_probe )
+            {
+            double secs = (now - last_probe) / 1e9;
+            double rate = secs > 0 ? (total - last_handled) / secs : 0;
+            counter_set(mailbox_depth,
+                        static_cast<uint64_t>(rate * delay / 1e9));
+            }
+
+        counter_set(mailbox_delay_ns, delay);
+        last_probe = now;
+        last_handled = total;
+        }
+
+    // Adds these counters to 'out', which may already hold those of other
+    // shards of the same store.  Per-shard gauges that don't sum up, like
+    // mailbox delay, take the worst shard's value instead.
+    void add_to(aclone_stats* out) const
+        {
+        out->inserts += counter_get(inserts);
+        out->increments += counter_get(increments);
+        out->decrements += counter_get(decrements);
+        out->removes += counter_get(removes);
+        out->clears += counter_get(clears);
+        out->lookups += counter_get(lookups);
+        out->haskeys += counter_get(haskeys);
+        out->sizes += counter_get(sizes);
+        out->fetch_adds += counter_get(fetch_adds);
+        out->compare_swaps += counter_get(compare_swaps);
+        out->snapshots += counter_get(snapshots);
+        out->replays += counter_get(replays);
+        out->keys += counter_get(keys);
+        out->memory += counter_get(memory);
+        out->subscribers = std::max(out->subscribers,
+                                    counter_get(subscribers));
+        out->mailbox_depth += counter_get(mailbox_depth);
+        out->mailbox_delay_ns = std::max(out->mailbox_delay_ns,
+                                         counter_get(mailbox_delay_ns));
+        out->publish_flushes += counter_get(publish_flushes);
+        out->key_pages += counter_get(key_pages);
+        out->wal_commits += counter_get(wal_commits);
+        out->wal_bytes += counter_get(wal_bytes);
+        out->compactions += counter_get(compactions);
+        out->snapshot_bytes += counter_get(snapshot_bytes);
+        out->snapshot_wire_bytes += counter_get(snapshot_wire_bytes);
+        out->snapshot_codec_ns += counter_get(snapshot_codec_ns);
+        out->expirations += counter_get(expirations);
+        out->ttl_keys += counter_get(ttl_keys);
+        out->filtered_updates += counter_get(filtered_updates);
+        update_latency.add_to(&out->update_latency);
+        request_latency.add_to(&out->request_latency);
+        publish_batch_ops.add_to(&out->publish_batch_ops);
+        }
+
+    std::atomic<uint64_t> inserts;
+    std::atomic<uint64_t> increments;
+    std::atomic<uint64_t> decrements;
+    std::atomic<uint64_t> removes;
+    std::atomic<uint64_t> clears;
+    std::atomic<uint64_t> lookups;
+    std::atomic<uint64_t> haskeys;
+    std::atomic<uint64_t> sizes;
+    std::atomic<uint64_t> fetch_adds;
+    std::atomic<uint64_t> compare_swaps;
+    std::atomic<uint64_t> snapshots;
+    std::atomic<uint64_t> replays;
+    std::atomic<uint64_t> keys;
+    std::atomic<uint64_t> memory;
+    std::atomic<uint64_t> subscribers;
+    std::atomic<uint64_t> mailbox_depth;
+    std::atomic<uint64_t> mailbox_delay_ns;
+    std::atomic<uint64_t> publish_flushes;
+    std::atomic<uint64_t> key_pages;
+    // Written by a durable master's log writer thread, except compactions.
+    std::atomic<uint64_t> wal_commits;
+    std::atomic<uint64_t> wal_bytes;
+    std::atomic<uint64_t> compactions;
+    std::atomic<uint64_t> snapshot_bytes;
+    std::atomic<uint64_t> snapshot_wire_bytes;
+    std::atomic<uint64_t> snapshot_codec_ns;
+    std::atomic<uint64_t> expirations;
+    std::atomic<uint64_t> ttl_keys;
+    std::atomic<uint64_t> filtered_updates;
+    latency_histogram update_latency;
+    latency_histogram request_latency;
+    latency_histogram publish_batch_ops;
+
+private:
+
+    int64_t last_probe = 0;
+    uint64_t last_handled = 0;
+};
+
+} // namespace aclone
+
+#endif // ACLONE_STATS_HPP
@@ -0,0 +1,265 @@
+#ifndef ACLONE_STORE_FILE_HPP
+#define ACLONE_STORE_FILE_HPP
+
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "kv_store.hpp"
+#include "mapped_file.hpp"
+
+namespace aclone {
+
+// A cloner's store as of some sequence of its master's history, laid out to
+// be read in place through a memory mapping:
+//
+//   header     magic, epoch, sequence, entry count, shard, shard count,
+//              offset of the index
+//   entries    per key, in key order: key length, value length (both
+//              32-bit), key bytes, value bytes
+//   index      64-bit offset of each entry, for binary search
+//
+// Fields are in host byte order, as only the host that wrote a file reads
+// it back.  Files are written whole and renamed into place, so a reader
+// never sees a partial one.
+class store_file {
+public:
+
+    // Maps a file written by write(), throwing if it isn't one.
+    explicit store_file(const std::string& path)
+        : file(path, MADV_RANDOM)
+        {
+        if ( file.size() < sizeof(header) )
+            throw std::runtime_error("truncated " + path);
+
+        memcpy(&hdr, file.data(), sizeof(hdr));
+
+        if ( hdr.magic != magic || hdr.index_off < sizeof(hdr) ||
+             hdr.index_off % sizeof(uint64_t) ||
+             hdr.index_off > file.size() ||
+             (file.size() - hdr.index_off) / sizeof(uint64_t) < hdr.count )
+            throw std::runtime_error("bad cloner store file " + path);
+
+        index = reinterpret_cast<const uint64_t*>(file.data() +
+                                                  hdr.index_off);
+        }
+
+    uint64_t epoch() const
+        { return hdr.epoch; }
+
+    kv_sequence sequence() const
+        {
+        kv_sequence rval;
+        rval.hi = hdr.seq_hi;
+        rval.lo = hdr.seq_lo;
+        return rval;
+        }
+
+    uint64_t size() const
+        { return hdr.count; }
+
+    uint32_t shard() const
+        { return hdr.shard; }
+
+    uint32_t shards() const
+        { return hdr.shards; }
+
+    // Binary search of the index, touching only the pages it probes.
+    bool find(const key_view& key, val_type* val) const
+        {
+        uint64_t lo = 0;
+        uint64_t hi = hdr.count;
+
+        while ( lo < hi )
+            {
+            auto mid = lo + (hi - lo) / 2;
+            key_view k;
+            const char* v;
+            uint32_t vlen;
+
+            if ( ! entry(mid, &k, &v, &vlen) )
+                return false;
+
+            int c = k.compare(key);
+
+            if ( c == 0 )
+                {
+                if ( val )
+                    *val = val_type(v, vlen);
+
+                return true;
+                }
+
+            if ( c < 0 )
+                lo = mid + 1;
+            else
+                hi = mid;
+            }
+
+        return false;
+        }
+
+    // Puts every entry into 'out', which gets the file's sequence.
+    // Returns false if the file is corrupt.
+    bool load(kv_store& out) const
+        {
+        out = kv_store{};
+
+        for ( uint64_t i = 0; i < hdr.count; ++i )
+            {
+            key_view k;
+            const char* v;
+            uint32_t vlen;
+
+            if ( ! entry(i, &k, &v, &vlen) )
+                return false;
+
+            out.put(k, val_type(v, vlen));
+            }
+
+        out.sequence = sequence();
+        return true;
+        }
+
+    // Writes 'store' to 'path' via a temporary file, returning false on
+    // failure.
+    static bool write(const std::string& path, uint64_t epoch,
+                      const kv_store& store, uint32_t shard, uint32_t shards)
+        {
+        auto tmp = path + ".tmp";
+        int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                      0644);
+
+        if ( fd < 0 )
+            return false;
+
+        header h;
+        h.magic = magic;
+        h.epoch = epoch;
+        h.seq_hi = store.sequence.hi;
+        h.seq_lo = store.sequence.lo;
+        h.count = store.store.size();
+        h.shard = shard;
+        h.shards = shards;
+
+        std::vector<uint64_t> offsets;
+        offsets.reserve(store.store.size());
+        std::string buf;
+        uint64_t off = sizeof(h);
+        bool ok = true;
+        buf.append(sizeof(h), '\0');
+
+        for ( const auto& kv : store.store )
+            {
+            uint32_t klen = kv.first.size();
+            uint32_t vlen = kv.second.size();
+            offsets.push_back(off);
+            buf.append(reinterpret_cast<const char*>(&klen), sizeof(klen));
+            buf.append(reinterpret_cast<const char*>(&vlen), sizeof(vlen));
+            buf.append(kv.first.data(), klen);
+            buf.append(kv.second.data(), vlen);
+            off += 2 * sizeof(uint32_t) + klen + vlen;
+
+            if ( buf.size() >= write_chunk )
+                {
+                ok = ok && write_all(fd, buf);
+                buf.clear();
+                }
+            }
+
+        auto pad = (sizeof(uint64_t) - off % sizeof(uint64_t)) %
+                   sizeof(uint64_t);
+        buf.append(pad, '\0');
+        h.index_off = off + pad;
+        buf.append(reinterpret_cast<const char*>(offsets.data()),
+                   offsets.size() * sizeof(uint64_t));
+        ok = ok && write_all(fd, buf);
+
+        // The header goes in last, once the index offset is known.
+        ok = ok && pwrite(fd, &h, sizeof(h), 0) == sizeof(h);
+        ok = ok && fdatasync(fd) == 0;
+        close(fd);
+
+        if ( ! ok || rename(tmp.c_str(), path.c_str()) < 0 )
+            {
+            unlink(tmp.c_str());
+            return false;
+            }
+
+        return true;
+        }
+
+private:
+
+    // "ACLOCLN1", read little-endian.
+    static const uint64_t magic = 0x314e4c434f4c4341;
+    static const size_t write_chunk = 1 << 20;
+
+    struct header {
+        uint64_t magic;
+        uint64_t epoch;
+        uint64_t seq_hi;
+        uint64_t seq_lo;
+        uint64_t count;
+        uint32_t shard;
+        uint32_t shards;
+        uint64_t index_off;
+    };
+
+    static bool write_all(int fd, const std::string& buf)
+        {
+        const char* p = buf.data();
+        size_t n = buf.size();
+
+        while ( n )
+            {
+            auto rc = ::write(fd, p, n);
+
+            if ( rc < 0 && errno == EINTR )
+                continue;
+
+            if ( rc < 0 )
+                return false;
+
+            p += rc;
+            n -= rc;
+            }
+
+        return true;
+        }
+
+    bool entry(uint64_t i, key_view* key, const char** val,
+               uint32_t* vlen) const
+        {
+        uint64_t off = index[i];
+        uint32_t klen;
+
+        if ( off > hdr.index_off || hdr.index_off - off < 8 )
+            return false;
+
+        memcpy(&klen, file.data() + off, sizeof(klen));
+        memcpy(vlen, file.data() + off + 4, sizeof(*vlen));
+
+        if ( hdr.index_off - off - 8 < uint64_t(klen) + *vlen )
+            return false;
+
+        *key = key_view(file.data() + off + 8, klen);
+        *val = file.data() + off + 8 + klen;
+        return true;
+        }
+
+    mapped_file file;
+    header hdr;
+    const uint64_t* index;
+};
+
+} // namespace aclone
+
+#endif // ACLONE_STORE_FILE_HPP
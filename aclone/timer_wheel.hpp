@@ -0,0 +1,140 @@
+#ifndef ACLONE_TIMER_WHEEL_HPP
+#define ACLONE_TIMER_WHEEL_HPP
+
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+
+namespace aclone {
+
+// A hierarchical timing wheel over integer ticks.  Timers due within the
+// next 64 ticks sit in the first level's slot for their tick; later ones
+// sit in coarser levels, whose slots each span 64 times as many ticks as
+// the level below, and are moved down a level whenever the level below
+// wraps around.  Scheduling is O(1), and a timer is moved at most once per
+// level before it fires, so running N timers costs O(N) plus O(1) per tick
+// advanced, without ever scanning for the ones that are due.  Timers too
+// far out for the top level are parked in it and placed again when moved.
+template <typename T>
+class timer_wheel {
+public:
+
+    static const int slot_bits = 6;
+    static const size_t slots = size_t(1) << slot_bits;
+    static const int levels = 4;
+
+    explicit timer_wheel(uint64_t now = 0)
+        : current(now)
+        {}
+
+    // A timer for a tick the wheel has already run through is due on the
+    // next one.  The wheel only keeps time in advance() and catch_up(), so
+    // one that has sat empty should be caught up first, or the next
+    // advance() steps through every tick since.
+    void schedule(uint64_t tick, T item)
+        {
+        place(timer{tick, std::move(item)});
+        ++count;
+        }
+
+    // Runs the wheel through tick 'now', calling f(tick, item) for each
+    // timer that comes due, in order of tick.  'f' may schedule timers.
+    template <typename F>
+    void advance(uint64_t now, F f)
+        {
+        catch_up(now);
+
+        while ( current <= now && count )
+            {
+            for ( int level = 1; level < levels; ++level )
+                {
+                if ( current & slot_mask(level - 1) )
+                    break;
+
+                cascade(level);
+                }
+
+            std::vector<timer> due;
+            due.swap(wheel[0][current & (slots - 1)]);
+            count -= due.size();
+
+            for ( auto& t : due )
+                f(t.tick, t.item);
+
+            ++current;
+            }
+
+        current = std::max(current, now + 1);
+        }
+
+    // Runs an empty wheel through tick 'now' in one step, as nothing can
+    // come due.
+    void catch_up(uint64_t now)
+        {
+        if ( ! count )
+            current = std::max(current, now + 1);
+        }
+
+    void clear()
+        {
+        for ( auto& level : wheel )
+            for ( auto& slot : level )
+                slot.clear();
+
+        count = 0;
+        }
+
+    bool empty() const
+        { return count == 0; }
+
+    size_t size() const
+        { return count; }
+
+private:
+
+    struct timer {
+        uint64_t tick;
+        T item;
+    };
+
+    // The ticks below those a level's slots are selected by.
+    static uint64_t slot_mask(int level)
+        { return (uint64_t(1) << (slot_bits * (level + 1))) - 1; }
+
+    void place(timer t)
+        {
+        auto tick = std::max(t.tick, current);
+        auto delta = tick - current;
+        int level = 0;
+
+        while ( level < levels - 1 && delta > slot_mask(level) )
+            ++level;
+
+        if ( delta > slot_mask(levels - 1) )
+            tick = current + slot_mask(levels - 1);
+
+        auto slot = (tick >> (slot_bits * level)) & (slots - 1);
+        wheel[level][slot].push_back(std::move(t));
+        }
+
+    // Moves the timers in a level's current slot down to finer levels.
+    void cascade(int level)
+        {
+        auto slot = (current >> (slot_bits * level)) & (slots - 1);
+        std::vector<timer> moving;
+        moving.swap(wheel[level][slot]);
+
+        for ( auto& t : moving )
+            place(std::move(t));
+        }
+
+    std::vector<timer> wheel[levels][slots];
+    // The next tick to run.
+    uint64_t current;
+    size_t count = 0;
+};
+
+} // namespace aclone
+
+#endif // ACLONE_TIMER_WHEEL_HPP
@@ -0,0 +1,242 @@
+#ifndef ACLONE_WIRE_HPP
+#define ACLONE_WIRE_HPP
+
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <utility>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+
+#include "kv_store.hpp"
+
+namespace aclone {
+
+// The compact encoding replicated updates and snapshot chunks are sent in.
+// Integers are varints (7 bits per byte, least significant group first),
+// and byte strings are a varint length followed by the bytes.  An update
+// is its op, then its key and value where the op has them, so a batch of
+// expirations is just their keys; a skip is its op and count.
+class wire_writer {
+public:
+
+    void put_byte(uint8_t b)
+        { buf.push_back(static_cast<char>(b)); }
+
+    void put_varint(uint64_t v)
+        {
+        while ( v >= 0x80 )
+            {
+            put_byte(static_cast<uint8_t>(v) | 0x80);
+            v >>= 7;
+            }
+
+        put_byte(static_cast<uint8_t>(v));
+        }
+
+    void put_bytes(const char* data, size_t size)
+        {
+        put_varint(size);
+        buf.append(data, size);
+        }
+
+    void put_sequence(const kv_sequence& seq)
+        {
+        put_varint(seq.hi);
+        put_varint(seq.lo);
+        }
+
+    void put_update(const kv_update& u)
+        {
+        put_byte(u.op);
+
+        if ( u.op == KV_OP_CLEAR )
+            return;
+
+        if ( u.op == KV_OP_SKIP )
+            {
+            put_varint(u.val.as_int());
+            return;
+            }
+
+        put_bytes(u.key.data(), u.key.size());
+
+        if ( u.op != KV_OP_REMOVE && u.op != KV_OP_EXPIRE )
+            put_bytes(u.val.data(), u.val.size());
+        }
+
+    std::string& buffer()
+        { return buf; }
+
+private:
+
+    std::string buf;
+};
+
+// Reads what a wire_writer wrote, throwing std::runtime_error if it runs
+// past the end or finds something malformed.
+class wire_reader {
+public:
+
+    wire_reader(const char* data, size_t size)
+        : p(data), end(data + size)
+        {}
+
+    bool done() const
+        { return p == end; }
+
+    size_t remaining() const
+        { return end - p; }
+
+    uint8_t get_byte()
+        {
+        if ( p == end )
+            throw std::runtime_error("truncated message");
+
+        return static_cast<uint8_t>(*p++);
+        }
+
+    uint64_t get_varint()
+        {
+        uint64_t rval = 0;
+
+        for ( int shift = 0; shift < 64; shift += 7 )
+            {
+            uint8_t b = get_byte();
+            rval |= static_cast<uint64_t>(b & 0x7f) << shift;
+
+            if ( ! (b & 0x80) )
+                return rval;
+            }
+
+        throw std::runtime_error("malformed varint");
+        }
+
+    // Returns a pointer to the next byte string, which stays in place.
+    const char* get_bytes(size_t* size)
+        {
+        *size = get_varint();
+
+        if ( static_cast<size_t>(end - p) < *size )
+            throw std::runtime_error("truncated message");
+
+        auto rval = p;
+        p += *size;
+        return rval;
+        }
+
+    kv_sequence get_sequence()
+        {
+        kv_sequence rval;
+        rval.hi = get_varint();
+        rval.lo = get_varint();
+        return rval;
+        }
+
+    kv_update get_update()
+        {
+        kv_update rval;
+        rval.op = get_byte();
+
+        if ( rval.op > KV_OP_SKIP )
+            throw std::runtime_error("unknown update op");
+
+        if ( rval.op == KV_OP_CLEAR )
+            return rval;
+
+        if ( rval.op == KV_OP_SKIP )
+            {
+            rval.val = kv_value::from_int(get_varint());
+            return rval;
+            }
+
+        size_t n;
+        auto k = get_bytes(&n);
+        rval.key.assign(k, n);
+
+        if ( rval.op != KV_OP_REMOVE && rval.op != KV_OP_EXPIRE )
+            {
+            auto v = get_bytes(&n);
+            rval.val = val_type(v, n);
+            }
+
+        return rval;
+        }
+
+private:
+
+    const char* p;
+    const char* end;
+};
+
+// A run of updates under consecutive sequence numbers, as a master
+// publishes them: the first sequence, the number of updates, and then
+// each update.  Encoded once, then shared by every subscriber it's sent to
+// and by the replay log, so that sending it only copies bytes.
+class kv_packed {
+public:
+
+    kv_packed() = default;
+
+    explicit kv_packed(std::string arg_bytes)
+        : bytes(std::make_shared<const std::string>(std::move(arg_bytes)))
+        {}
+
+    template <typename It>
+    static kv_packed encode(const kv_sequence& first, It begin, It end)
+        {
+        wire_writer w;
+        w.put_sequence(first);
+        w.put_varint(std::distance(begin, end));
+
+        for ( auto it = begin; it != end; ++it )
+            w.put_update(*it);
+
+        return kv_packed(std::move(w.buffer()));
+        }
+
+    // Returns the first sequence and fills 'ops', throwing
+    // std::runtime_error if malformed.
+    kv_sequence decode(kv_batch* ops) const
+        {
+        wire_reader r(data(), size());
+        auto first = r.get_sequence();
+        auto n = r.get_varint();
+        ops->clear();
+        // Every update takes at least a byte.
+        ops->reserve(std::min<uint64_t>(n, size()));
+
+        for ( uint64_t i = 0; i < n; ++i )
+            ops->push_back(r.get_update());
+
+        if ( ! r.done() )
+            throw std::runtime_error("trailing bytes in update message");
+
+        return first;
+        }
+
+    const char* data() const
+        { return bytes ? bytes->data() : ""; }
+
+    size_t size() const
+        { return bytes ? bytes->size() : 0; }
+
+private:
+
+    std::shared_ptr<const std::string> bytes;
+};
+
+inline bool operator==(const kv_packed& lhs, const kv_packed& rhs)
+    {
+    return lhs.size() == rhs.size() &&
+           std::char_traits<char>::compare(lhs.data(), rhs.data(),
+                                           lhs.size()) == 0;
+    }
+
+inline bool operator!=(const kv_packed& lhs, const kv_packed& rhs)
+    { return ! operator==(lhs, rhs); }
+
+} // namespace aclone
+
+#endif // ACLONE_WIRE_HPP
@@ -0,0 +1,676 @@
+// End-to-end benchmark of a topic's master together with cloner and remote
+// handles of it, all opened through the C API in this process and connected
+// over loopback.  Client threads issue a weighted mix of operations at a
+// fixed open-loop rate: each operation is due at a time fixed in advance and
+// its latency is measured from then, so a slow response delays (and is
+// charged to) the operations queued behind it instead of thinning out the
+// offered load.  Meanwhile the master is sent a timestamp every so often,
+// and a thread per cloner polls its replica for it to measure replication
+// lag.  Results are written to stdout as JSON.
+//
+// Inserts and increments return once handed to the library, so their
+// latency is only that of issuing them; what it then takes to apply and
+// replicate them shows up as replication lag.
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <getopt.h>
+
+#include <cppa/cppa.hpp>
+
+#include "aclone/aclone.h"
+
+using namespace std;
+
+using bench_clock = chrono::steady_clock;
+
+enum bench_op {
+    OP_INSERT,
+    OP_INCREMENT,
+    OP_LOOKUP,
+    OP_HASKEY,
+    OP_SIZE,
+    OP_COUNT,
+};
+
+static const char* op_names[OP_COUNT] = {
+    "insert", "increment", "lookup", "haskey", "size",
+};
+
+// Which handles the client threads send their operations through.
+enum bench_target {
+    TARGET_MASTER,
+    TARGET_REMOTE,
+    TARGET_CLONER,
+};
+
+static const char* target_names[] = { "master", "remote", "cloner" };
+
+static const char* lag_key = "aclone_bench:lag";
+
+struct bench_config {
+    bench_target target = TARGET_CLONER;
+    string addr = "127.0.0.1";
+    uint16_t port = 9998;
+    size_t cloners = 1;
+    bool relay = false;
+    size_t remotes = 1;
+    size_t shards = 1;
+    size_t threads = 1;
+    double rate = 10000;
+    double duration = 10;
+    double warmup = 1;
+    uint64_t keys = 100000;
+    size_t value_size = 8;
+    uint32_t flush_us = 0;
+    double lag_interval_ms = 10;
+    double lag_poll_us = 50;
+    unsigned weights[OP_COUNT] = { 5, 5, 70, 15, 5 };
+};
+
+// What one client thread saw, merged once all are done.
+struct op_results {
+    vector<uint64_t> latency_ns;
+    uint64_t errors = 0;
+};
+
+struct thread_results {
+    op_results ops[OP_COUNT];
+};
+
+static void usage(const string& program)
+    {
+    fprintf(stderr, "%s [options]\n", program.c_str());
+    fprintf(stderr, "    -t|--target      | master, remote or cloner "
+                    "(default cloner)\n");
+    fprintf(stderr, "    -c|--cloners     | cloners to open (default 1)\n");
+    fprintf(stderr, "    -e|--relay       | other cloners sync via the "
+                    "first, on port+1\n");
+    fprintf(stderr, "    -r|--remotes     | remotes to open (default 1)\n");
+    fprintf(stderr, "    -s|--shards      | number of master shards\n");
+    fprintf(stderr, "    -T|--threads     | client threads (default 1)\n");
+    fprintf(stderr, "    -R|--rate        | total target ops/s\n");
+    fprintf(stderr, "    -D|--duration    | seconds measured\n");
+    fprintf(stderr, "    -w|--warmup      | seconds run before measuring\n");
+    fprintf(stderr, "    -k|--keys        | keys preloaded and used\n");
+    fprintf(stderr, "    -v|--value-size  | bytes per inserted value\n");
+    fprintf(stderr, "    -m|--mix         | e.g. insert=5,increment=5,"
+                    "lookup=70,haskey=15,size=5\n");
+    fprintf(stderr, "    -f|--flush-us    | master publish_flush_us\n");
+    fprintf(stderr, "    -l|--lag-ms      | interval between lag probes\n");
+    fprintf(stderr, "    -a|--addr        | loopback addr to publish on\n");
+    fprintf(stderr, "    -p|--port        | port to publish on\n");
+    }
+
+static option long_options[] = {
+    {"target",       required_argument,    0, 't'},
+    {"cloners",      required_argument,    0, 'c'},
+    {"relay",        no_argument,          0, 'e'},
+    {"remotes",      required_argument,    0, 'r'},
+    {"shards",       required_argument,    0, 's'},
+    {"threads",      required_argument,    0, 'T'},
+    {"rate",         required_argument,    0, 'R'},
+    {"duration",     required_argument,    0, 'D'},
+    {"warmup",       required_argument,    0, 'w'},
+    {"keys",         required_argument,    0, 'k'},
+    {"value-size",   required_argument,    0, 'v'},
+    {"mix",          required_argument,    0, 'm'},
+    {"flush-us",     required_argument,    0, 'f'},
+    {"lag-ms",       required_argument,    0, 'l'},
+    {"addr",         required_argument,    0, 'a'},
+    {"port",         required_argument,    0, 'p'},
+    {0,              0,                    0, 0},
+};
+
+static const char* opt_string = "t:c:er:s:T:R:D:w:k:v:m:f:l:a:p:";
+
+// Parses "name=weight,..."; operations not named get no weight.
+static bool parse_mix(const string& mix, unsigned* weights)
+    {
+    fill(weights, weights + OP_COUNT, 0);
+    size_t pos = 0;
+
+    while ( pos < mix.size() )
+        {
+        auto end = mix.find(',', pos);
+
+        if ( end == string::npos )
+            end = mix.size();
+
+        auto item = mix.substr(pos, end - pos);
+        auto eq = item.find('=');
+
+        if ( eq == string::npos )
+            return false;
+
+        auto name = item.substr(0, eq);
+        auto op = find(op_names, op_names + OP_COUNT, name) - op_names;
+
+        if ( op == OP_COUNT )
+            return false;
+
+        weights[op] = strtoul(item.c_str() + eq + 1, 0, 10);
+        pos = end + 1;
+        }
+
+    return any_of(weights, weights + OP_COUNT,
+                  [](unsigned w) { return w > 0; });
+    }
+
+static bool parse_target(const string& s, bench_target* target)
+    {
+    for ( int i = TARGET_MASTER; i <= TARGET_CLONER; ++i )
+        if ( s == target_names[i] )
+            {
+            *target = static_cast<bench_target>(i);
+            return true;
+            }
+
+    return false;
+    }
+
+static uint64_t now_ns()
+    {
+    auto t = bench_clock::now().time_since_epoch();
+    return chrono::duration_cast<chrono::nanoseconds>(t).count();
+    }
+
+static string make_key(uint64_t i)
+    {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "key%012lu", i);
+    return buf;
+    }
+
+static aclone_key c_key(const string& k)
+    {
+    return aclone_key{const_cast<char*>(k.data()), k.size()};
+    }
+
+static bool preload(aclone_context* ctx, aclone_store* master,
+                    const bench_config& cfg)
+    {
+    aclone_batch* batch = aclone_batch_create();
+    vector<char> value(cfg.value_size, 'v');
+    bool ok = true;
+
+    for ( uint64_t i = 0; ok && i < cfg.keys; ++i )
+        {
+        auto k = make_key(i);
+        int64_t n = i;
+        aclone_val v{&n, sizeof(n)};
+
+        if ( cfg.value_size != sizeof(n) )
+            v = aclone_val{value.data(), value.size()};
+
+        aclone_batch_insert(batch, c_key(k), v);
+
+        if ( aclone_batch_size(batch) == 1000 || i + 1 == cfg.keys )
+            {
+            ok = aclone_store_apply_batch(ctx, master, batch);
+            aclone_batch_reset(batch);
+            }
+        }
+
+    aclone_batch_destroy(batch);
+    return ok;
+    }
+
+// Waits for a store to hold the preloaded keys, giving up after a minute.
+static bool wait_for_size(aclone_context* ctx, aclone_store* store,
+                          uint64_t size)
+    {
+    auto deadline = bench_clock::now() + chrono::minutes(1);
+
+    while ( bench_clock::now() < deadline )
+        {
+        uint64_t n;
+
+        if ( aclone_store_size_sync(ctx, store, &n) && n >= size )
+            return true;
+
+        this_thread::sleep_for(chrono::milliseconds(10));
+        }
+
+    return false;
+    }
+
+// Issues one client thread's share of the load through 'store' until
+// 'end', recording the latency of operations due after 'measure_from'.
+static void run_client(aclone_context* ctx, aclone_store* store,
+                       const bench_config& cfg, unsigned seed,
+                       bench_clock::time_point start,
+                       bench_clock::time_point measure_from,
+                       bench_clock::time_point end, thread_results* out)
+    {
+    mt19937_64 rng(seed);
+    discrete_distribution<int> pick_op(cfg.weights, cfg.weights + OP_COUNT);
+    uniform_int_distribution<uint64_t> pick_key(0, cfg.keys - 1);
+    vector<char> value(cfg.value_size, 'v');
+    int64_t one = 1;
+    auto interval = chrono::duration<double>(cfg.threads / cfg.rate);
+
+    for ( uint64_t i = 0; ; ++i )
+        {
+        auto due = start + chrono::duration_cast<bench_clock::duration>(
+                               interval * i);
+
+        if ( due >= end )
+            break;
+
+        this_thread::sleep_until(due);
+
+        int op = pick_op(rng);
+        auto k = make_key(pick_key(rng));
+        int ok = 0;
+
+        switch ( op ) {
+        case OP_INSERT:
+            ok = aclone_store_insert(ctx, store, c_key(k),
+                                     aclone_val{value.data(), value.size()});
+            break;
+        case OP_INCREMENT:
+            ok = aclone_store_increment(ctx, store, c_key(k),
+                                        aclone_val{&one, sizeof(one)});
+            break;
+        case OP_LOOKUP:
+            {
+            aclone_val v{0, 0};
+            ok = aclone_store_lookup_sync(ctx, store, c_key(k), &v);
+            free(v.val);
+            }
+            break;
+        case OP_HASKEY:
+            {
+            int exists;
+            ok = aclone_store_haskey_sync(ctx, store, c_key(k), &exists);
+            }
+            break;
+        case OP_SIZE:
+            {
+            uint64_t size;
+            ok = aclone_store_size_sync(ctx, store, &size);
+            }
+            break;
+        }
+
+        if ( due < measure_from )
+            continue;
+
+        auto& res = out->ops[op];
+
+        if ( ! ok )
+            {
+            ++res.errors;
+            continue;
+            }
+
+        auto latency = bench_clock::now() - due;
+        res.latency_ns.push_back(
+            chrono::duration_cast<chrono::nanoseconds>(latency).count());
+        }
+    }
+
+// Writes the current time to the lag probe key every lag interval.
+static void run_prober(aclone_context* ctx, aclone_store* master,
+                       const bench_config& cfg, const atomic<bool>* stop)
+    {
+    auto interval = chrono::duration<double, milli>(cfg.lag_interval_ms);
+    string k = lag_key;
+
+    while ( ! *stop )
+        {
+        int64_t t = now_ns();
+        aclone_store_insert(ctx, master, c_key(k), aclone_val{&t, sizeof(t)});
+        this_thread::sleep_for(interval);
+        }
+    }
+
+// Polls a cloner for new lag probes, recording how long after being sent
+// each one arrived.  Samples are only as precise as the polling interval.
+static void run_lag_poller(aclone_context* ctx, aclone_store* cloner,
+                           const bench_config& cfg, uint64_t measure_from,
+                           const atomic<bool>* stop, vector<uint64_t>* out)
+    {
+    auto interval = chrono::duration<double, micro>(cfg.lag_poll_us);
+    string k = lag_key;
+    int64_t last = 0;
+
+    while ( ! *stop )
+        {
+        aclone_val v{0, 0};
+
+        if ( aclone_store_lookup_sync(ctx, cloner, c_key(k), &v) &&
+             v.size == sizeof(int64_t) )
+            {
+            int64_t sent;
+            memcpy(&sent, v.val, sizeof(sent));
+
+            if ( sent != last )
+                {
+                uint64_t arrived = now_ns();
+                last = sent;
+
+                if ( uint64_t(sent) >= measure_from )
+                    out->push_back(arrived - sent);
+                }
+            }
+
+        free(v.val);
+        this_thread::sleep_for(interval);
+        }
+    }
+
+static double percentile_us(const vector<uint64_t>& sorted, double q)
+    {
+    if ( sorted.empty() )
+        return 0;
+
+    size_t i = min(sorted.size() - 1, size_t(q * sorted.size()));
+    return sorted[i] / 1000.0;
+    }
+
+static void print_latency(const char* indent, vector<uint64_t>& samples)
+    {
+    sort(samples.begin(), samples.end());
+    printf("%s\"p50_us\": %.1f,\n", indent, percentile_us(samples, 0.5));
+    printf("%s\"p99_us\": %.1f,\n", indent, percentile_us(samples, 0.99));
+    printf("%s\"p999_us\": %.1f,\n", indent, percentile_us(samples, 0.999));
+    printf("%s\"max_us\": %.1f\n", indent,
+           samples.empty() ? 0 : samples.back() / 1000.0);
+    }
+
+static void print_results(const bench_config& cfg,
+                          vector<thread_results>& results,
+                          vector<uint64_t>& lag)
+    {
+    printf("{\n");
+    printf("  \"config\": {\n");
+    printf("    \"target\": \"%s\",\n", target_names[cfg.target]);
+    printf("    \"cloners\": %zu,\n", cfg.cloners);
+    printf("    \"relay\": %s,\n", cfg.relay ? "true" : "false");
+    printf("    \"remotes\": %zu,\n", cfg.remotes);
+    printf("    \"shards\": %zu,\n", cfg.shards);
+    printf("    \"threads\": %zu,\n", cfg.threads);
+    printf("    \"target_ops_per_sec\": %.1f,\n", cfg.rate);
+    printf("    \"duration_sec\": %.1f,\n", cfg.duration);
+    printf("    \"keys\": %lu,\n", cfg.keys);
+    printf("    \"value_size\": %zu,\n", cfg.value_size);
+    printf("    \"publish_flush_us\": %u,\n", cfg.flush_us);
+    printf("    \"mix\": {");
+
+    for ( int op = 0; op < OP_COUNT; ++op )
+        printf("%s\"%s\": %u", op ? ", " : " ", op_names[op],
+               cfg.weights[op]);
+
+    printf(" }\n");
+    printf("  },\n");
+
+    uint64_t total = 0;
+    uint64_t errors = 0;
+    printf("  \"ops\": {\n");
+
+    for ( int op = 0; op < OP_COUNT; ++op )
+        {
+        vector<uint64_t> samples;
+        uint64_t op_errors = 0;
+
+        for ( auto& r : results )
+            {
+            auto& s = r.ops[op].latency_ns;
+            samples.insert(samples.end(), s.begin(), s.end());
+            op_errors += r.ops[op].errors;
+            }
+
+        total += samples.size();
+        errors += op_errors;
+        printf("    \"%s\": {\n", op_names[op]);
+        printf("      \"count\": %zu,\n", samples.size());
+        printf("      \"errors\": %lu,\n", op_errors);
+        printf("      \"ops_per_sec\": %.1f,\n",
+               samples.size() / cfg.duration);
+        print_latency("      ", samples);
+        printf("    }%s\n", op + 1 < OP_COUNT ? "," : "");
+        }
+
+    printf("  },\n");
+    printf("  \"total\": {\n");
+    printf("    \"count\": %lu,\n", total);
+    printf("    \"errors\": %lu,\n", errors);
+    printf("    \"ops_per_sec\": %.1f\n", total / cfg.duration);
+    printf("  },\n");
+    printf("  \"replication_lag\": {\n");
+    printf("    \"samples\": %zu,\n", lag.size());
+    print_latency("    ", lag);
+    printf("  }\n");
+    printf("}\n");
+    }
+
+int main(int argc, char** argv)
+    {
+    bench_config cfg;
+
+    for ( ; ; )
+        {
+        int o = getopt_long(argc, argv, opt_string, long_options, 0);
+
+        if ( o == -1 )
+            break;
+
+        switch ( o ) {
+        case 't':
+            if ( ! parse_target(optarg, &cfg.target) )
+                {
+                usage(argv[0]);
+                return 1;
+                }
+            break;
+        case 'c':
+            cfg.cloners = stoul(optarg);
+            break;
+        case 'e':
+            cfg.relay = true;
+            break;
+        case 'r':
+            cfg.remotes = stoul(optarg);
+            break;
+        case 's':
+            cfg.shards = stoul(optarg);
+            break;
+        case 'T':
+            cfg.threads = max(1ul, stoul(optarg));
+            break;
+        case 'R':
+            cfg.rate = stod(optarg);
+            break;
+        case 'D':
+            cfg.duration = stod(optarg);
+            break;
+        case 'w':
+            cfg.warmup = stod(optarg);
+            break;
+        case 'k':
+            cfg.keys = max(1ul, stoul(optarg));
+            break;
+        case 'v':
+            cfg.value_size = stoul(optarg);
+            break;
+        case 'm':
+            if ( ! parse_mix(optarg, cfg.weights) )
+                {
+                usage(argv[0]);
+                return 1;
+                }
+            break;
+        case 'f':
+            cfg.flush_us = stoul(optarg);
+            break;
+        case 'l':
+            cfg.lag_interval_ms = stod(optarg);
+            break;
+        case 'a':
+            cfg.addr = optarg;
+            break;
+        case 'p':
+            cfg.port = stoul(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+        }
+
+    if ( cfg.rate <= 0 || cfg.duration <= 0 ||
+         ( cfg.target == TARGET_REMOTE && ! cfg.remotes ) ||
+         ( cfg.target == TARGET_CLONER && ! cfg.cloners ) )
+        {
+        usage(argv[0]);
+        return 1;
+        }
+
+    const char* topic = "aclone_bench";
+    aclone_context* ctx = aclone_context_create(0);
+    aclone_master_config config;
+    aclone_master_config_init(&config);
+    config.shards = cfg.shards;
+    config.publish_flush_us = cfg.flush_us;
+    aclone_store* master = aclone_store_open_master_config(ctx, topic, 0,
+                                                           &config);
+
+    if ( ! master ||
+         ! aclone_store_publish_master(ctx, master, cfg.addr.c_str(),
+                                       cfg.port) )
+        {
+        fprintf(stderr, "Failed to open master.\n");
+        return 1;
+        }
+
+    fprintf(stderr, "preloading %lu keys\n", cfg.keys);
+
+    if ( ! preload(ctx, master, cfg) ||
+         ! wait_for_size(ctx, master, cfg.keys) )
+        {
+        fprintf(stderr, "Failed to preload master.\n");
+        return 1;
+        }
+
+    vector<aclone_store*> remotes;
+    vector<aclone_store*> cloners;
+
+    for ( size_t i = 0; i < cfg.remotes; ++i )
+        if ( auto r = aclone_store_open_remote(ctx, topic, cfg.addr.c_str(),
+                                               cfg.port, 0) )
+            remotes.push_back(r);
+        else
+            {
+            fprintf(stderr, "Failed to open remote.\n");
+            return 1;
+            }
+
+    // With a relay, every cloner but the first is fed by the first.
+    uint16_t relay_port = cfg.port + 1;
+
+    for ( size_t i = 0; i < cfg.cloners; ++i )
+        {
+        auto port = cfg.relay && i ? relay_port : cfg.port;
+        auto c = aclone_store_open_cloner(ctx, topic, cfg.addr.c_str(), port,
+                                          0);
+
+        if ( ! c || (cfg.relay && ! i &&
+                     ! aclone_store_publish_relay(ctx, c, cfg.addr.c_str(),
+                                                  relay_port)) )
+            {
+            fprintf(stderr, "Failed to open cloner.\n");
+            return 1;
+            }
+
+        cloners.push_back(c);
+        }
+
+    for ( auto c : cloners )
+        if ( ! wait_for_size(ctx, c, cfg.keys) )
+            {
+            fprintf(stderr, "Cloner failed to synchronize.\n");
+            return 1;
+            }
+
+    vector<aclone_store*> targets;
+
+    switch ( cfg.target ) {
+    case TARGET_MASTER:
+        targets.push_back(master);
+        break;
+    case TARGET_REMOTE:
+        targets = remotes;
+        break;
+    case TARGET_CLONER:
+        targets = cloners;
+        break;
+    }
+
+    fprintf(stderr, "running %.0f ops/s for %.1f+%.1f seconds\n", cfg.rate,
+            cfg.warmup, cfg.duration);
+
+    auto warmup = chrono::duration<double>(cfg.warmup);
+    auto duration = chrono::duration<double>(cfg.duration);
+    auto start = bench_clock::now();
+    auto measure_from = start +
+        chrono::duration_cast<bench_clock::duration>(warmup);
+    auto end = measure_from +
+        chrono::duration_cast<bench_clock::duration>(duration);
+    uint64_t lag_from = now_ns() +
+        chrono::duration_cast<chrono::nanoseconds>(warmup).count();
+    atomic<bool> stop{false};
+    vector<thread_results> results(cfg.threads);
+    vector<vector<uint64_t>> lags(cloners.size());
+    vector<thread> clients;
+    vector<thread> pollers;
+    thread prober(run_prober, ctx, master, cref(cfg), &stop);
+
+    for ( size_t i = 0; i < cloners.size(); ++i )
+        pollers.emplace_back(run_lag_poller, ctx, cloners[i], cref(cfg),
+                             lag_from, &stop, &lags[i]);
+
+    for ( size_t i = 0; i < cfg.threads; ++i )
+        clients.emplace_back(run_client, ctx, targets[i % targets.size()],
+                             cref(cfg), i + 1, start, measure_from, end,
+                             &results[i]);
+
+    for ( auto& t : clients )
+        t.join();
+
+    stop = true;
+    prober.join();
+
+    for ( auto& t : pollers )
+        t.join();
+
+    vector<uint64_t> lag;
+
+    for ( const auto& l : lags )
+        lag.insert(lag.end(), l.begin(), l.end());
+
+    print_results(cfg, results, lag);
+    fflush(stdout);
+
+    for ( auto c : cloners )
+        aclone_store_close(ctx, c);
+
+    for ( auto r : remotes )
+        aclone_store_close(ctx, r);
+
+    aclone_store_close(ctx, master);
+    aclone_context_destroy(ctx);
+    cppa::await_all_actors_done();
+    cppa::shutdown();
+    return 0;
+    }
@@ -0,0 +1,127 @@
+// Measures how long a durable master takes from being opened to serving:
+// loading its last snapshot and replaying the write-ahead log after it.
+// The store is built through the same durable_log a master uses, logging
+// every insert, compacting once, then logging a tail of increments.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "aclone/durable.hpp"
+
+using namespace std;
+using namespace aclone;
+
+static double seconds_since(chrono::steady_clock::time_point start)
+    {
+    auto elapsed = chrono::steady_clock::now() - start;
+    return chrono::duration<double>(elapsed).count();
+    }
+
+static void remove_dir(const string& dir)
+    {
+    DIR* d = opendir(dir.c_str());
+
+    while ( auto e = d ? readdir(d) : 0 )
+        if ( e->d_name[0] != '.' )
+            unlink((dir + "/" + e->d_name).c_str());
+
+    if ( d )
+        closedir(d);
+
+    rmdir(dir.c_str());
+    }
+
+int main(int argc, char** argv)
+    {
+    uint64_t keys = argc > 1 ? strtoull(argv[1], 0, 10) : 10000000;
+    uint64_t tail = argc > 2 ? strtoull(argv[2], 0, 10) : keys / 10;
+    char tmpl[] = "/tmp/aclone-durable-XXXXXX";
+
+    if ( ! mkdtemp(tmpl) )
+        {
+        perror("mkdtemp");
+        return 1;
+        }
+
+    string dir = tmpl;
+    auto stats = make_shared<store_stats>();
+    auto start = chrono::steady_clock::now();
+
+        {
+        durable_log wal(dir, "bench.0", 0, stats);
+        wal.recover();
+        kv_store store;
+        char key[32];
+
+        for ( uint64_t i = 0; i < keys; ++i )
+            {
+            snprintf(key, sizeof(key), "key%012lu", i);
+            store.update(key, kv_value::from_int(i));
+            wal.append(store.sequence,
+                       kv_update{KV_OP_INSERT, key, kv_value::from_int(i)});
+            }
+
+        wal.begin_snapshot(store.sequence);
+        bool resume = false;
+        key_type after;
+
+        for ( ; ; )
+            {
+            auto chunk = cut_chunk(store, resume, after, 256 * 1024);
+            wal.write_chunk(chunk);
+
+            if ( chunk.last )
+                break;
+
+            resume = true;
+            after = chunk.entries.rbegin()->first;
+            }
+
+        for ( uint64_t i = 0; i < tail; ++i )
+            {
+            snprintf(key, sizeof(key), "key%012lu", (i * 7919) % keys);
+            store.increment(key, 1);
+            wal.append(store.sequence, kv_update{KV_OP_INCREMENT, key,
+                                                 kv_value::from_int(1)});
+            }
+        }
+
+    double build_secs = seconds_since(start);
+    uint64_t commits = counter_get(stats->wal_commits);
+    uint64_t logged = counter_get(stats->wal_bytes);
+
+    start = chrono::steady_clock::now();
+    kv_store recovered;
+
+        {
+        durable_log wal(dir, "bench.0", 0, make_shared<store_stats>());
+        wal.recover();
+        wal.restore(recovered);
+        }
+
+    double recover_secs = seconds_since(start);
+    remove_dir(dir);
+
+    if ( recovered.store.size() != keys )
+        {
+        fprintf(stderr, "recovered %zu keys, expected %lu\n",
+                recovered.store.size(), keys);
+        return 1;
+        }
+
+    printf("%-28s %14lu\n", "keys", keys);
+    printf("%-28s %14lu\n", "logged tail updates", tail);
+    printf("%-28s %14.2f\n", "build+log+compact seconds", build_secs);
+    printf("%-28s %14lu\n", "group commits", commits);
+    printf("%-28s %14.2f\n", "updates per commit",
+           static_cast<double>(keys + tail) / (commits ? commits : 1));
+    printf("%-28s %14.1f\n", "MiB logged", logged / 1048576.0);
+    printf("%-28s %14.2f\n", "restart-to-serving seconds", recover_secs);
+    return 0;
+    }
@@ -0,0 +1,176 @@
+// Counts heap allocations per update on the master's path, from the key
+// the C API hands over to the message published to cloners, comparing
+// keys held as std::string map keys (as this tree used to) with keys
+// interned in the store's arena.  Keys are long enough that std::string
+// can't hold them inline.
+
+#include <new>
+#include <map>
+#include <tuple>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "aclone/kv_store.hpp"
+
+using namespace std;
+using namespace aclone;
+
+static uint64_t allocations = 0;
+
+void* operator new(size_t size)
+    {
+    ++allocations;
+
+    if ( void* p = malloc(size) )
+        return p;
+
+    throw bad_alloc();
+    }
+
+void operator delete(void* p) noexcept
+    {
+    free(p);
+    }
+
+// Stands in for the tuple a published update travels in.
+using update_msg = tuple<kv_sequence, key_type, val_type>;
+
+// Just enough of the old kv_store: one std::string per map node, and the
+// published message copying the update's key.
+struct legacy_store {
+
+    void update(const key_type& key, const val_type& val)
+        {
+        ++sequence;
+        store[key] = val;
+        }
+
+    void increment(const key_type& key, int64_t by)
+        {
+        ++sequence;
+        auto& v = store[key];
+        v = kv_value::from_int(v.as_int() + by);
+        }
+
+    void remove(const key_type& key)
+        {
+        ++sequence;
+        store.erase(key);
+        }
+
+    static update_msg publish(const kv_sequence& seq, const kv_update& u)
+        { return update_msg(seq, u.key, u.val); }
+
+    map<key_type, val_type> store;
+    kv_sequence sequence;
+};
+
+struct arena_store : kv_store {
+
+    static update_msg publish(const kv_sequence& seq, kv_update u)
+        { return update_msg(seq, move(u.key), move(u.val)); }
+};
+
+struct result {
+    double ns_per_op;
+    double allocs_per_op;
+};
+
+template <typename F>
+static result measure(uint64_t ops, F op)
+    {
+    uint64_t allocs_before = allocations;
+    auto start = chrono::steady_clock::now();
+
+    for ( uint64_t i = 0; i < ops; ++i )
+        op(i);
+
+    auto elapsed = chrono::steady_clock::now() - start;
+    return { chrono::duration<double, nano>(elapsed).count() / ops,
+             static_cast<double>(allocations - allocs_before) / ops };
+    }
+
+static key_type make_key(uint64_t i)
+    {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "session:%016lu:counter", i);
+    return buf;
+    }
+
+// Increments an existing key the way the master does: the key arrives as
+// a string, the store applies it, and the update is published.
+template <typename Store>
+static result steady_increments(const vector<key_type>& keys, uint64_t ops)
+    {
+    Store store;
+
+    for ( const auto& k : keys )
+        store.update(k, kv_value::from_int(0));
+
+    auto by = kv_value::from_int(1);
+    uint64_t sink = 0;
+
+    auto res = measure(ops, [&](uint64_t i)
+        {
+        const key_type& arrived = keys[i % keys.size()];
+        key_type key = arrived;
+        store.increment(key, 1);
+        auto msg = Store::publish(store.sequence,
+                                  kv_update{KV_OP_INCREMENT, move(key), by});
+        sink += get<1>(msg).size();
+        });
+
+    if ( ! sink )
+        exit(1);
+
+    return res;
+    }
+
+// Inserts new keys while removing old ones, keeping the store's size fixed.
+template <typename Store>
+static result key_churn(const vector<key_type>& keys, uint64_t ops)
+    {
+    Store store;
+    size_t live = keys.size() / 2;
+
+    for ( size_t i = 0; i < live; ++i )
+        store.update(keys[i], kv_value::from_int(0));
+
+    return measure(ops, [&](uint64_t i)
+        {
+        store.update(keys[(i + live) % keys.size()], kv_value::from_int(1));
+        store.remove(keys[i % keys.size()]);
+        });
+    }
+
+static void report(const char* name, const result& old_res,
+                   const result& new_res)
+    {
+    printf("%-18s %-16s %10.2f %14.2f\n", name, "std::string keys",
+           old_res.ns_per_op, old_res.allocs_per_op);
+    printf("%-18s %-16s %10.2f %14.2f\n", "", "key arena",
+           new_res.ns_per_op, new_res.allocs_per_op);
+    }
+
+int main(int argc, char** argv)
+    {
+    uint64_t ops = argc > 1 ? strtoull(argv[1], 0, 10) : 1000000;
+    vector<key_type> keys;
+
+    for ( int i = 0; i < 4096; ++i )
+        keys.push_back(make_key(i));
+
+    printf("%-18s %-16s %10s %14s\n", "workload", "store", "ns/op",
+           "allocs/op");
+    report("steady increment",
+           steady_increments<legacy_store>(keys, ops),
+           steady_increments<arena_store>(keys, ops));
+    report("insert+remove",
+           key_churn<legacy_store>(keys, ops),
+           key_churn<arena_store>(keys, ops));
+    return 0;
+    }
@@ -0,0 +1,163 @@
+// Compares the fixed-width kv_sequence against the previous vector-backed
+// implementation on the path a cloner takes for every replicated update:
+// take the store's next sequence, compare it with the update's, apply.
+
+#include <new>
+#include <map>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "aclone/kv_store.hpp"
+
+using namespace std;
+using namespace aclone;
+
+static uint64_t allocations = 0;
+
+void* operator new(size_t size)
+    {
+    ++allocations;
+
+    if ( void* p = malloc(size) )
+        return p;
+
+    throw bad_alloc();
+    }
+
+void operator delete(void* p) noexcept
+    {
+    free(p);
+    }
+
+// The vector-backed kv_sequence this tree used to ship.
+class legacy_sequence {
+public:
+
+    legacy_sequence next() const
+        {
+        legacy_sequence rval = *this;
+        vector<uint64_t>& n = rval.sequence;
+
+        for ( int i = n.size() - 1; i >= 0; --i )
+            {
+            ++n[i];
+
+            if ( n[i] != 0 )
+                break;
+
+            if ( i == 0 )
+                n.insert(n.begin(), 1);
+            }
+
+        return rval;
+        }
+
+    legacy_sequence& operator++()
+        {
+        sequence = move(next().sequence);
+        return *this;
+        }
+
+    vector<uint64_t> sequence = { 0 };
+};
+
+inline bool operator==(const legacy_sequence& lhs, const legacy_sequence& rhs)
+    { return lhs.sequence == rhs.sequence; }
+
+// Just enough of the old kv_store to replay the cloner's apply path.
+struct legacy_store {
+
+    void update(const key_type& key, const val_type& val)
+        {
+        ++sequence;
+        store[key] = val;
+        }
+
+    void increment(const key_type& key, int64_t by)
+        {
+        ++sequence;
+        auto& v = store[key];
+        v = kv_value::from_int(v.as_int() + by);
+        }
+
+    map<key_type, val_type> store;
+    legacy_sequence sequence;
+};
+
+struct result {
+    double ns_per_op;
+    double allocs_per_op;
+};
+
+template <typename Store, typename Seq>
+static result apply_path(Store& store, const vector<key_type>& keys,
+                         uint64_t ops)
+    {
+    Seq seq = store.sequence;
+    uint64_t applied = 0;
+    uint64_t allocs_before = allocations;
+    auto start = chrono::steady_clock::now();
+
+    for ( uint64_t i = 0; i < ops; ++i )
+        {
+        ++seq;
+        Seq next = store.sequence.next();
+
+        if ( seq == next )
+            {
+            const key_type& key = keys[i % keys.size()];
+            store.increment(key, 1);
+            ++applied;
+            }
+        }
+
+    auto elapsed = chrono::steady_clock::now() - start;
+    uint64_t allocs = allocations - allocs_before;
+
+    if ( applied != ops )
+        {
+        fprintf(stderr, "sequence mismatch after %lu ops\n", applied);
+        exit(1);
+        }
+
+    return { chrono::duration<double, nano>(elapsed).count() / ops,
+             static_cast<double>(allocs) / ops };
+    }
+
+int main(int argc, char** argv)
+    {
+    uint64_t ops = argc > 1 ? strtoull(argv[1], 0, 10) : 10000000;
+    vector<key_type> keys;
+
+    for ( int i = 0; i < 1024; ++i )
+        keys.push_back("key" + to_string(i));
+
+    legacy_store old_store;
+    kv_store new_store;
+
+    // Populate first so the timed loops only update existing keys.
+    for ( const auto& k : keys )
+        {
+        old_store.update(k, kv_value::from_int(0));
+        new_store.update(k, kv_value::from_int(0));
+        }
+
+    auto old_res = apply_path<legacy_store, legacy_sequence>(old_store, keys,
+                                                              ops);
+    auto new_res = apply_path<kv_store, kv_sequence>(new_store, keys, ops);
+
+    printf("%-22s %12s %14s\n", "cloner apply path", "ns/update",
+           "allocs/update");
+    printf("%-22s %12.2f %14.2f\n", "vector kv_sequence", old_res.ns_per_op,
+           old_res.allocs_per_op);
+    printf("%-22s %12.2f %14.2f\n", "fixed-width", new_res.ns_per_op,
+           new_res.allocs_per_op);
+    printf("%-22s %12.2f %14.2f\n", "saved per update",
+           old_res.ns_per_op - new_res.ns_per_op,
+           old_res.allocs_per_op - new_res.allocs_per_op);
+    return 0;
+    }
@@ -0,0 +1,655 @@
+// Microbenchmarks of the core data structures and of what replication puts
+// on the wire: kv_store updates, removes and lookups at a range of store
+// sizes, kv_sequence arithmetic, the timer wheel TTLs expire from, and
+// libcppa serialization of the messages a master sends (single updates and
+// the chunks a snapshot is streamed in, with each combination of snapshot
+// codecs), cutting a partial replica's snapshot, plus the one-time cost of
+// announcing aclone's types.
+//
+// Keys are visited in a fixed pseudo-random permutation, so runs are
+// repeatable; each measurement is repeated and the median reported, and
+// results are written to stdout as JSON with a fixed set of fields, so
+// they can be compared across commits.
+
+#include <map>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+#include <algorithm>
+#include <functional>
+#include <getopt.h>
+
+#include <cppa/cppa.hpp>
+
+#include "aclone/kv_store.hpp"
+#include "aclone/snapshot.hpp"
+#include "aclone/key_filter.hpp"
+#include "aclone/timer_wheel.hpp"
+#include "aclone/master.hpp"
+#include "aclone/chunk_codec.hpp"
+#include "aclone/serialization.hpp"
+
+using namespace std;
+using namespace aclone;
+
+using bench_clock = chrono::steady_clock;
+
+// A master's default snapshot_chunk_bytes.
+static const size_t chunk_bytes = 256 * 1024;
+
+struct bench_params {
+    vector<uint64_t> keys = { 1000, 100000, 1000000 };
+    size_t key_len = 16;
+    size_t value_size = 8;
+    size_t reps = 5;
+    uint64_t max_ops = 1000000;
+    vector<string> groups = { "kv_store", "kv_sequence", "timer_wheel",
+                              "serialization" };
+};
+
+struct result {
+    string name;
+    uint64_t keys;
+    uint64_t ops;
+    vector<double> ns_per_op;
+    double bytes_per_op;
+};
+
+static vector<result> results;
+
+// Keeps the optimizer from discarding work whose result is otherwise unused.
+static volatile uint64_t sink;
+
+static double ns_since(bench_clock::time_point start)
+    {
+    auto elapsed = bench_clock::now() - start;
+    return chrono::duration<double, nano>(elapsed).count();
+    }
+
+// Adds one repetition's timing to the named result.
+static void record(const string& name, uint64_t keys, uint64_t ops,
+                   double ns, double bytes_per_op = 0)
+    {
+    for ( auto& r : results )
+        if ( r.name == name && r.keys == keys )
+            {
+            r.ns_per_op.push_back(ns / ops);
+            return;
+            }
+
+    results.push_back({name, keys, ops, {ns / ops}, bytes_per_op});
+    }
+
+// Makes the compiler assume 'v' is read and changed here, so that loops
+// over it can't be folded away.
+template <typename T>
+static void clobber(T& v)
+    {
+    asm volatile("" : "+m"(v));
+    }
+
+// Writes key 'i' into 'key': its decimal digits, right-aligned and padded
+// to the key length.  Cheap next to what it's used to measure; see the
+// kv_store.make_key result.
+static void make_key(uint64_t i, size_t len, key_type* key)
+    {
+    char digits[20];
+    char* p = digits + sizeof(digits);
+
+    do
+        {
+        *--p = '0' + i % 10;
+        i /= 10;
+        } while ( i );
+
+    size_t n = digits + sizeof(digits) - p;
+    key->assign(len > n ? len - n : 0, 'k');
+    key->append(p, n);
+    }
+
+// Visits [0, n) in a scrambled but fixed order.
+class permutation {
+public:
+
+    explicit permutation(uint64_t arg_n)
+        : n(arg_n), step(2654435761u)
+        {
+        while ( gcd(step, n) != 1 )
+            step += 2;
+        }
+
+    uint64_t operator()(uint64_t i) const
+        { return (i % n) * step % n; }
+
+private:
+
+    static uint64_t gcd(uint64_t a, uint64_t b)
+        { return b ? gcd(b, a % b) : a; }
+
+    uint64_t n;
+    uint64_t step;
+};
+
+static val_type make_value(size_t size)
+    {
+    if ( size == sizeof(int64_t) )
+        return kv_value::from_int(42);
+
+    string bytes(size, 'v');
+    return val_type(bytes.data(), bytes.size());
+    }
+
+static void bench_kv_store(const bench_params& p, uint64_t n)
+    {
+    permutation order(n);
+    uint64_t ops = min(n, p.max_ops);
+    auto val = make_value(p.value_size);
+    key_type key;
+    key.reserve(p.key_len + 24);
+
+    for ( size_t rep = 0; rep < p.reps; ++rep )
+        {
+        auto start = bench_clock::now();
+
+        for ( uint64_t i = 0; i < ops; ++i )
+            {
+            make_key(order(i), p.key_len, &key);
+            clobber(key[0]);
+            }
+
+        record("kv_store.make_key", n, ops, ns_since(start));
+
+        kv_store store;
+        start = bench_clock::now();
+
+        for ( uint64_t i = 0; i < n; ++i )
+            {
+            make_key(order(i), p.key_len, &key);
+            store.update(key, val);
+            }
+
+        record("kv_store.update.insert", n, n, ns_since(start));
+
+        start = bench_clock::now();
+
+        for ( uint64_t i = 0; i < ops; ++i )
+            {
+            make_key(order(i * 7), p.key_len, &key);
+            store.update(key, val);
+            }
+
+        record("kv_store.update.overwrite", n, ops, ns_since(start));
+
+        uint64_t found = 0;
+        start = bench_clock::now();
+
+        for ( uint64_t i = 0; i < ops; ++i )
+            {
+            make_key(order(i * 13), p.key_len, &key);
+            found += store.store.find(key) != store.store.end();
+            }
+
+        record("kv_store.lookup.hit", n, ops, ns_since(start));
+
+        start = bench_clock::now();
+
+        for ( uint64_t i = 0; i < ops; ++i )
+            {
+            make_key(n + order(i), p.key_len, &key);
+            found += store.store.find(key) != store.store.end();
+            }
+
+        record("kv_store.lookup.miss", n, ops, ns_since(start));
+        sink = found;
+
+        start = bench_clock::now();
+
+        for ( uint64_t i = 0; i < n; ++i )
+            {
+            make_key(order(i * 3), p.key_len, &key);
+            store.remove(key);
+            }
+
+        record("kv_store.remove", n, n, ns_since(start));
+        }
+    }
+
+static void bench_kv_sequence(const bench_params& p)
+    {
+    uint64_t ops = p.max_ops * 10;
+
+    for ( size_t rep = 0; rep < p.reps; ++rep )
+        {
+        kv_sequence seq;
+        auto start = bench_clock::now();
+
+        for ( uint64_t i = 0; i < ops; ++i )
+            {
+            seq = seq.next();
+            clobber(seq);
+            }
+
+        record("kv_sequence.next", 0, ops, ns_since(start));
+        sink = seq.lo;
+
+        start = bench_clock::now();
+
+        for ( uint64_t i = 0; i < ops; ++i )
+            {
+            ++seq;
+            clobber(seq);
+            }
+
+        record("kv_sequence.increment", 0, ops, ns_since(start));
+        sink = seq.lo;
+
+        // Compares against a sequence that differs only in the low word, as
+        // a cloner checking the next update mostly does.
+        vector<kv_sequence> seqs(1024);
+
+        for ( size_t i = 0; i < seqs.size(); ++i )
+            {
+            seqs[i].hi = 1;
+            seqs[i].lo = i * 7919 % seqs.size();
+            }
+
+        uint64_t less = 0;
+        start = bench_clock::now();
+
+        for ( uint64_t i = 0; i < ops; ++i )
+            less += seqs[i % seqs.size()] < seqs[(i + 1) % seqs.size()];
+
+        record("kv_sequence.compare", 0, ops, ns_since(start));
+        sink = less;
+        }
+    }
+
+// Schedules timers spread over the next ten seconds of 10ms ticks and runs
+// the wheel through them, as a master does for keys with TTLs.  Then times
+// scheduling a timer on a wheel that has sat idle for 30 days, caught up
+// to the current tick first as master::expire_at() does.  Returns false if
+// any timer fires early, late or not at all.
+static bool bench_timer_wheel(const bench_params& p)
+    {
+    uint64_t ops = p.max_ops;
+    const uint64_t horizon = 1000;
+    const uint64_t idle = 30ull * 24 * 3600 * 100;
+
+    for ( size_t rep = 0; rep < p.reps; ++rep )
+        {
+        timer_wheel<uint64_t> wheel;
+        uint64_t fired = 0;
+        auto start = bench_clock::now();
+
+        for ( uint64_t i = 0; i < ops; ++i )
+            wheel.schedule(1 + i * 7919 % horizon, i);
+
+        record("timer_wheel.schedule", 0, ops, ns_since(start));
+
+        start = bench_clock::now();
+        wheel.advance(horizon, [&](uint64_t, uint64_t&) { ++fired; });
+        record("timer_wheel.advance", 0, ops, ns_since(start));
+
+        if ( fired != ops )
+            {
+            fprintf(stderr, "timer_wheel: %lu of %lu timers fired\n", fired,
+                    ops);
+            return false;
+            }
+
+        uint64_t now = horizon;
+        uint64_t misfired = 0;
+        start = bench_clock::now();
+
+        for ( uint64_t i = 0; i < 10; ++i )
+            {
+            now += idle;
+            wheel.catch_up(now);
+            wheel.schedule(now + 1, i);
+            wheel.advance(now, [&](uint64_t, uint64_t&) { ++misfired; });
+            wheel.advance(now + 1, [&](uint64_t tick, uint64_t&)
+                {
+                ++fired;
+
+                if ( tick != now + 1 )
+                    ++misfired;
+                });
+            }
+
+        record("timer_wheel.schedule_after_idle", 0, 10, ns_since(start));
+
+        if ( fired != ops + 10 || misfired )
+            {
+            fprintf(stderr, "timer_wheel: timers misfired after idling\n");
+            return false;
+            }
+        }
+
+    return true;
+    }
+
+static size_t serialize(const cppa::any_tuple& msg, vector<char>* buf)
+    {
+    buf->clear();
+    cppa::binary_serializer bs(back_inserter(*buf));
+    bs << msg;
+    return buf->size();
+    }
+
+static void deserialize(const vector<char>& buf, cppa::any_tuple* msg)
+    {
+    cppa::binary_deserializer bd(buf.data(), buf.size());
+    bd >> *msg;
+    }
+
+static void bench_updates(const bench_params& p)
+    {
+    uint64_t ops = p.max_ops;
+    auto val = make_value(p.value_size);
+    key_type key;
+    vector<char> buf;
+    cppa::any_tuple msg;
+    kv_sequence seq;
+
+    for ( size_t rep = 0; rep < p.reps; ++rep )
+        {
+        size_t bytes = 0;
+        auto start = bench_clock::now();
+
+        for ( uint64_t i = 0; i < ops; ++i )
+            {
+            make_key(i, p.key_len, &key);
+            kv_update u{KV_OP_INSERT, key, val};
+            msg = packed_msg(++seq, &u, &u + 1);
+            }
+
+        record("message.update.build", 0, ops, ns_since(start));
+
+        start = bench_clock::now();
+
+        for ( uint64_t i = 0; i < ops; ++i )
+            bytes = serialize(msg, &buf);
+
+        record("serialization.update.write", 0, ops, ns_since(start), bytes);
+
+        start = bench_clock::now();
+
+        for ( uint64_t i = 0; i < ops; ++i )
+            deserialize(buf, &msg);
+
+        record("serialization.update.read", 0, ops, ns_since(start), bytes);
+        }
+    }
+
+// Streams a whole store the way a master serves a snapshot, with each
+// combination of snapshot codecs, timing cutting it into chunks, encoding
+// and writing each chunk's message, and reading and decoding it, per key;
+// then just cutting one that only some keys pass a filter for.
+static void bench_snapshot(const bench_params& p, uint64_t n)
+    {
+    static const struct {
+        uint32_t codecs;
+        const char* suffix;
+    } variants[] = {
+        { 0, "" },
+        { ACLONE_SNAPSHOT_FRONT_CODING, ".front_coded" },
+        { ACLONE_SNAPSHOT_FRONT_CODING | ACLONE_SNAPSHOT_LZ,
+          ".front_coded_lz" },
+    };
+
+    kv_store store;
+    auto val = make_value(p.value_size);
+    key_type key;
+
+    for ( uint64_t i = 0; i < n; ++i )
+        {
+        make_key(i, p.key_len, &key);
+        store.update(key, val);
+        }
+
+    for ( size_t rep = 0; rep < p.reps; ++rep )
+        for ( const auto& v : variants )
+            {
+            double cut_ns = 0;
+            double write_ns = 0;
+            double read_ns = 0;
+            uint64_t bytes = 0;
+            bool resume = false;
+            key_type after;
+            vector<char> buf;
+            cppa::any_tuple msg;
+
+            for ( ; ; )
+                {
+                auto start = bench_clock::now();
+                auto chunk = cut_chunk(store, resume, after, chunk_bytes);
+                cut_ns += ns_since(start);
+
+                if ( ! chunk.last )
+                    after = chunk.entries.rbegin()->first;
+
+                start = bench_clock::now();
+                uint64_t kv_bytes;
+                auto packed = packed_chunk::encode(chunk, v.codecs, &kv_bytes);
+                bytes += serialize(cppa::make_any_tuple(cppa::atom("chunk"),
+                                                        uint64_t(1), packed),
+                                   &buf);
+                write_ns += ns_since(start);
+
+                start = bench_clock::now();
+                deserialize(buf, &msg);
+                kv_chunk decoded;
+                msg.get_as<packed_chunk>(2).decode(&decoded);
+                read_ns += ns_since(start);
+
+                if ( chunk.last )
+                    break;
+
+                resume = true;
+                }
+
+            string write = "serialization.snapshot.write";
+            string read = "serialization.snapshot.read";
+            double per_key = static_cast<double>(bytes) / n;
+
+            if ( ! v.codecs )
+                record("snapshot.cut", n, n, cut_ns);
+
+            record(write + v.suffix, n, n, write_ns, per_key);
+            record(read + v.suffix, n, n, read_ns, per_key);
+            }
+
+    // A partial replica's snapshot, of eight runs of keys spread across the
+    // store, timed per key it includes.
+    kv_filter filter;
+
+    for ( uint64_t i = 0; i < 8; ++i )
+        {
+        make_key(i * n / 8, p.key_len, &key);
+        filter.add_prefix(key.substr(0, key.size() - 2));
+        }
+
+    for ( size_t rep = 0; rep < p.reps; ++rep )
+        {
+        uint64_t cut = 0;
+        bool resume = false;
+        key_type after;
+        auto start = bench_clock::now();
+
+        for ( ; ; )
+            {
+            auto chunk = cut_chunk(store, resume, after, chunk_bytes, filter);
+            cut += chunk.entries.size();
+
+            if ( chunk.last )
+                break;
+
+            resume = true;
+            after = chunk.entries.rbegin()->first;
+            }
+
+        record("snapshot.cut.filtered", n, max(cut, uint64_t(1)),
+               ns_since(start));
+        }
+    }
+
+static double median(vector<double> v)
+    {
+    sort(v.begin(), v.end());
+    return v[v.size() / 2];
+    }
+
+static void print_results(const bench_params& p)
+    {
+    printf("{\n");
+    printf("  \"params\": {\n");
+    printf("    \"key_len\": %zu,\n", p.key_len);
+    printf("    \"value_size\": %zu,\n", p.value_size);
+    printf("    \"reps\": %zu,\n", p.reps);
+    printf("    \"max_ops\": %lu,\n", p.max_ops);
+    printf("    \"keys\": [");
+
+    for ( size_t i = 0; i < p.keys.size(); ++i )
+        printf("%s%lu", i ? ", " : "", p.keys[i]);
+
+    printf("]\n");
+    printf("  },\n");
+    printf("  \"results\": [\n");
+
+    for ( size_t i = 0; i < results.size(); ++i )
+        {
+        const auto& r = results[i];
+        auto minmax = minmax_element(r.ns_per_op.begin(), r.ns_per_op.end());
+        printf("    { \"name\": \"%s\", \"keys\": %lu, \"ops\": %lu, "
+               "\"ns_per_op\": %.2f, \"ns_per_op_min\": %.2f, "
+               "\"ns_per_op_max\": %.2f, \"bytes_per_op\": %.2f }%s\n",
+               r.name.c_str(), r.keys, r.ops, median(r.ns_per_op),
+               *minmax.first, *minmax.second, r.bytes_per_op,
+               i + 1 < results.size() ? "," : "");
+        }
+
+    printf("  ]\n");
+    printf("}\n");
+    }
+
+static void usage(const string& program)
+    {
+    fprintf(stderr, "%s [options]\n", program.c_str());
+    fprintf(stderr, "    -k|--keys        | store sizes, e.g. "
+                    "1000,1000000,100000000\n");
+    fprintf(stderr, "    -l|--key-len     | bytes per key (at least 12)\n");
+    fprintf(stderr, "    -v|--value-size  | bytes per value\n");
+    fprintf(stderr, "    -r|--reps        | repetitions of each measurement\n");
+    fprintf(stderr, "    -o|--max-ops     | ops per measurement, where not "
+                    "the store size\n");
+    fprintf(stderr, "    -g|--groups      | any of kv_store,kv_sequence,"
+                    "timer_wheel,serialization\n");
+    }
+
+static option long_options[] = {
+    {"keys",         required_argument,    0, 'k'},
+    {"key-len",      required_argument,    0, 'l'},
+    {"value-size",   required_argument,    0, 'v'},
+    {"reps",         required_argument,    0, 'r'},
+    {"max-ops",      required_argument,    0, 'o'},
+    {"groups",       required_argument,    0, 'g'},
+    {0,              0,                    0, 0},
+};
+
+static const char* opt_string = "k:l:v:r:o:g:";
+
+static vector<string> split(const string& s)
+    {
+    vector<string> rval;
+    size_t pos = 0;
+
+    while ( pos <= s.size() )
+        {
+        auto end = min(s.find(',', pos), s.size());
+
+        if ( end > pos )
+            rval.push_back(s.substr(pos, end - pos));
+
+        pos = end + 1;
+        }
+
+    return rval;
+    }
+
+int main(int argc, char** argv)
+    {
+    bench_params p;
+
+    for ( ; ; )
+        {
+        int o = getopt_long(argc, argv, opt_string, long_options, 0);
+
+        if ( o == -1 )
+            break;
+
+        switch ( o ) {
+        case 'k':
+            p.keys.clear();
+
+            for ( const auto& s : split(optarg) )
+                p.keys.push_back(max(1ul, stoul(s)));
+            break;
+        case 'l':
+            p.key_len = max(12ul, stoul(optarg));
+            break;
+        case 'v':
+            p.value_size = stoul(optarg);
+            break;
+        case 'r':
+            p.reps = max(1ul, stoul(optarg));
+            break;
+        case 'o':
+            p.max_ops = max(1ul, stoul(optarg));
+            break;
+        case 'g':
+            p.groups = split(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+        }
+
+    auto wants = [&](const char* group)
+        { return count(p.groups.begin(), p.groups.end(), group) > 0; };
+
+    if ( wants("serialization") )
+        {
+        auto start = bench_clock::now();
+        announce_types();
+        record("announce_types", 0, 1, ns_since(start));
+        }
+
+    if ( wants("kv_sequence") )
+        bench_kv_sequence(p);
+
+    if ( wants("timer_wheel") && ! bench_timer_wheel(p) )
+        return 1;
+
+    if ( wants("serialization") )
+        bench_updates(p);
+
+    for ( auto n : p.keys )
+        {
+        fprintf(stderr, "%lu keys\n", n);
+
+        if ( wants("kv_store") )
+            bench_kv_store(p, n);
+
+        if ( wants("serialization") )
+            bench_snapshot(p, n);
+        }
+
+    print_results(p);
+    cppa::shutdown();
+    return 0;
+    }
@@ -0,0 +1,243 @@
+// Compares the packed wire format replication uses with the generic
+// libcppa serialization it replaced, for the three kinds of message a
+// master sends: single updates, batches, and snapshot chunks.  The generic
+// path is reproduced with types announced member by member, as this tree
+// used to; both are run through libcppa's binary serializer, including
+// what the master does to build each message and what a cloner does to
+// get the updates back out of it.  Snapshot chunks are also compared
+// across the snapshot codecs.
+
+#include <map>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <iterator>
+
+#include <cppa/cppa.hpp>
+
+#include "aclone/kv_store.hpp"
+#include "aclone/snapshot.hpp"
+#include "aclone/master.hpp"
+#include "aclone/chunk_codec.hpp"
+#include "aclone/serialization.hpp"
+
+using namespace std;
+using namespace aclone;
+
+// Members of the generic path's messages, announced field by field.
+struct legacy_update {
+    uint8_t op;
+    key_type key;
+    val_type val;
+};
+
+inline bool operator==(const legacy_update& lhs, const legacy_update& rhs)
+    { return lhs.op == rhs.op && lhs.key == rhs.key && lhs.val == rhs.val; }
+
+using legacy_batch = vector<legacy_update>;
+
+struct legacy_chunk {
+    kv_sequence seq;
+    map<key_type, val_type> entries;
+    bool last = false;
+};
+
+inline bool operator==(const legacy_chunk& lhs, const legacy_chunk& rhs)
+    {
+    return lhs.seq == rhs.seq && lhs.entries == rhs.entries &&
+           lhs.last == rhs.last;
+    }
+
+struct result {
+    double bytes_per_op;
+    double write_ns_per_op;
+    double read_ns_per_op;
+};
+
+static volatile uint64_t sink;
+
+static double ns_since(chrono::steady_clock::time_point start)
+    {
+    auto elapsed = chrono::steady_clock::now() - start;
+    return chrono::duration<double, nano>(elapsed).count();
+    }
+
+static size_t serialize(const cppa::any_tuple& msg, vector<char>* buf)
+    {
+    buf->clear();
+    cppa::binary_serializer bs(back_inserter(*buf));
+    bs << msg;
+    return buf->size();
+    }
+
+static cppa::any_tuple deserialize(const vector<char>& buf)
+    {
+    cppa::any_tuple rval;
+    cppa::binary_deserializer bd(buf.data(), buf.size());
+    bd >> rval;
+    return rval;
+    }
+
+// Times 'reps' rounds of building and serializing a message with 'build'
+// and of deserializing it and extracting its contents with 'read', per
+// each of the 'ops' updates or entries a message carries.
+template <typename Build, typename Read>
+static result measure(uint64_t reps, uint64_t ops, Build build, Read read)
+    {
+    vector<char> buf;
+    size_t bytes = 0;
+    auto start = chrono::steady_clock::now();
+
+    for ( uint64_t i = 0; i < reps; ++i )
+        bytes = serialize(build(), &buf);
+
+    double write_ns = ns_since(start);
+    start = chrono::steady_clock::now();
+
+    for ( uint64_t i = 0; i < reps; ++i )
+        sink = read(deserialize(buf));
+
+    double read_ns = ns_since(start);
+    return { static_cast<double>(bytes) / ops, write_ns / (reps * ops),
+             read_ns / (reps * ops) };
+    }
+
+static key_type make_key(uint64_t i)
+    {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "session:%016lu:counter", i);
+    return buf;
+    }
+
+static void report(const char* name, const char* format, const result& r)
+    {
+    printf("%-20s %-16s %10.2f %12.2f %12.2f\n", name, format,
+           r.bytes_per_op, r.write_ns_per_op, r.read_ns_per_op);
+    }
+
+static void report(const char* name, const result& generic,
+                   const result& packed)
+    {
+    report(name, "generic", generic);
+    report("", "packed", packed);
+    }
+
+int main(int argc, char** argv)
+    {
+    uint64_t reps = argc > 1 ? strtoull(argv[1], 0, 10) : 100000;
+    size_t value_size = argc > 2 ? strtoull(argv[2], 0, 10) : 8;
+    announce_types();
+    cppa::announce<legacy_update>(&legacy_update::op, &legacy_update::key,
+                                  &legacy_update::val);
+    cppa::announce<legacy_batch>();
+    cppa::announce<legacy_chunk>(&legacy_chunk::seq, &legacy_chunk::entries,
+                                 &legacy_chunk::last);
+
+    string bytes(value_size, 'v');
+    val_type val = value_size == sizeof(int64_t) ? kv_value::from_int(1)
+                                                  : val_type(bytes.data(),
+                                                             bytes.size());
+    kv_sequence seq;
+    seq.lo = 123456789;
+    auto key = make_key(42);
+
+    printf("%-20s %-16s %10s %12s %12s\n", "message", "format", "bytes/op",
+           "write ns/op", "read ns/op");
+
+    auto generic_update = measure(reps, 1,
+        [&]() { return cppa::make_any_tuple(cppa::atom("increment"), seq,
+                                            key, val); },
+        [](const cppa::any_tuple& msg) { return msg.size(); });
+    auto packed_update = measure(reps, 1,
+        [&]()
+            {
+            kv_update u{KV_OP_INCREMENT, key, val};
+            return packed_msg(seq, &u, &u + 1);
+            },
+        [](const cppa::any_tuple& msg)
+            {
+            kv_batch ops;
+            msg.get_as<kv_packed>(1).decode(&ops);
+            return ops.size();
+            });
+    report("single update", generic_update, packed_update);
+
+    const size_t batch_ops = 64;
+    legacy_batch lbatch;
+    kv_batch batch;
+
+    for ( size_t i = 0; i < batch_ops; ++i )
+        {
+        lbatch.push_back({KV_OP_INSERT, make_key(i), val});
+        batch.push_back({KV_OP_INSERT, make_key(i), val});
+        }
+
+    auto generic_batch = measure(reps / batch_ops + 1, batch_ops,
+        [&]() { return cppa::make_any_tuple(cppa::atom("batch"), seq,
+                                            lbatch); },
+        [](const cppa::any_tuple& msg) { return msg.size(); });
+    auto packed_batch = measure(reps / batch_ops + 1, batch_ops,
+        [&]() { return packed_msg(seq, batch.begin(), batch.end()); },
+        [](const cppa::any_tuple& msg)
+            {
+            kv_batch ops;
+            msg.get_as<kv_packed>(1).decode(&ops);
+            return ops.size();
+            });
+    report("batch of 64", generic_batch, packed_batch);
+
+    // A chunk of about the default snapshot_chunk_bytes.
+    kv_store store;
+
+    for ( uint64_t i = 0; i < 10000; ++i )
+        store.update(make_key(i), val);
+
+    auto chunk = cut_chunk(store, false, key_type{}, 256 * 1024);
+    legacy_chunk lchunk;
+    lchunk.seq = chunk.seq;
+    lchunk.last = chunk.last;
+    lchunk.entries = chunk.entries;
+    auto entries = chunk.entries.size();
+    auto chunk_reps = reps / entries + 1;
+
+    auto generic_chunk = measure(chunk_reps, entries,
+        [&]() { return cppa::make_any_tuple(cppa::atom("chunk"), uint64_t(1),
+                                            lchunk); },
+        [](const cppa::any_tuple& msg) { return msg.size(); });
+    report("snapshot chunk", "generic", generic_chunk);
+
+    // Packed chunks, with each combination of snapshot codecs.
+    static const struct {
+        uint32_t codecs;
+        const char* format;
+    } variants[] = {
+        { 0, "packed" },
+        { ACLONE_SNAPSHOT_FRONT_CODING, "front coded" },
+        { ACLONE_SNAPSHOT_FRONT_CODING | ACLONE_SNAPSHOT_LZ,
+          "front coded+lz" },
+    };
+
+    for ( const auto& v : variants )
+        {
+        auto r = measure(chunk_reps, entries,
+            [&]()
+                {
+                uint64_t kv_bytes;
+                return cppa::make_any_tuple(cppa::atom("chunk"), uint64_t(1),
+                    packed_chunk::encode(chunk, v.codecs, &kv_bytes));
+                },
+            [](const cppa::any_tuple& msg)
+                {
+                kv_chunk decoded;
+                msg.get_as<packed_chunk>(2).decode(&decoded);
+                return decoded.entries.size();
+                });
+        report("", v.format, r);
+        }
+
+    cppa::shutdown();
+    return 0;
+    }
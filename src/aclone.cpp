@@ -2,19 +2,62 @@
 #include "aclone/master.hpp"
 #include "aclone/cloner.hpp"
 #include "aclone/requester.hpp"
+#include "aclone/stats.hpp"
+#include "aclone/serialization.hpp"
+#include "aclone/completion_queue.hpp"
+#include "aclone/frontend.hpp"
+#include "aclone/peers.hpp"
+#include "aclone/replica.hpp"
 
+#include <cmath>
+#include <cstdio>
+#include <cctype>
+#include <memory>
 #include <unordered_map>
 #include <vector>
 #include <string>
+#include <future>
 #include <mutex>
-#include <condition_variable>
+#include <utility>
+#include <functional>
+#include <algorithm>
 #include <cppa/cppa.hpp>
 
 using namespace std;
 using namespace cppa;
 
+struct aclone_completion_queue {
+    aclone::completion_queue q;
+};
+
+struct aclone_batch {
+    aclone::kv_batch ops;
+};
+
+struct aclone_cursor {
+    aclone_store* store;
+    // Shards are scanned one after another.
+    size_t shard;
+    aclone::key_type prefix;
+    aclone::key_type last;
+    uint64_t page_size;
+    bool with_values;
+    bool started;
+    bool done;
+    // The current page, and the C views of it handed out.
+    aclone::kv_keys keys;
+    vector<aclone::val_type> vals;
+    vector<aclone_key> key_views;
+    vector<aclone_val> val_views;
+};
+
 struct aclone_context {
     unordered_map<string, aclone_store*> masters;
+    // Where async completions go, if the application attached one.
+    aclone::completion_queue* cq;
+    // Front-ends masters are published through, by "addr:port".
+    unordered_map<string, actor> frontends;
+    shared_ptr<aclone::peer_cache> peers;
 };
 
 enum ACloneStoreMode {
@@ -24,66 +67,291 @@ enum ACloneStoreMode {
     ACLONE_STORE_MODE_COUNT,
 };
 
+// One of the actors a store's keys are partitioned across.
+struct aclone_shard {
+
+    aclone_shard(actor arg_a, shared_ptr<aclone::store_stats> arg_stats,
+                 shared_ptr<aclone::replica> arg_local = nullptr)
+        : a(move(arg_a)), stats(move(arg_stats)), local(move(arg_local)),
+          requests(make_shared<aclone::request_table>()),
+          channel(spawn<aclone::request_channel>(a, requests))
+        {}
+
+    actor a;
+    shared_ptr<aclone::store_stats> stats;
+    // A cloner's replica, which sync reads try on the caller's thread
+    // before messaging the actor.
+    shared_ptr<aclone::replica> local;
+    shared_ptr<aclone::request_table> requests;
+    // Receives responses to requests made through this handle.
+    actor channel;
+};
+
 struct aclone_store {
 
+    aclone_store(string arg_topic, ACloneStoreMode arg_mode)
+        : topic(move(arg_topic)), mode(arg_mode)
+        {}
+
     ~aclone_store()
         {
-		if ( mode != ACLONE_STORE_MODE_REMOTE )
-			anon_send(a, atom("quit"));
+        for ( const auto& s : shards )
+            {
+            if ( mode != ACLONE_STORE_MODE_REMOTE )
+                anon_send(s.a, atom("quit"));
+
+            anon_send(s.channel, atom("quit"));
+            }
+        }
+
+    size_t shard(const aclone::key_type& key) const
+        {
+        return aclone::shard_of(key, shards.size());
+        }
+
+    const actor& route(const aclone::key_type& key) const
+        {
+        return shards[shard(key)].a;
         }
 
     string topic;
     ACloneStoreMode mode;
-    actor a;
+    vector<aclone_shard> shards;
+    // Front-ends the store was published through as a master or relay, by
+    // "addr:port".
+    vector<string> published;
 };
 
+static bool sync_request(const aclone_store* store, size_t shard,
+                         const any_tuple& request, any_tuple& response,
+                         double timeout = -1);
+
 aclone_context* aclone_context_create(int flags)
     {
-    return new aclone_context{};
+    static once_flag announced;
+    call_once(announced, aclone::announce_types);
+    return new aclone_context{{}, 0, {},
+                              make_shared<aclone::peer_cache>()};
     }
 
 void aclone_context_destroy(aclone_context *ctx)
     {
+    for ( const auto& f : ctx->frontends )
+        anon_send(f.second, atom("quit"));
+
     delete ctx;
     }
 
+aclone_completion_queue* aclone_cq_create()
+    {
+    try
+        {
+        return new aclone_completion_queue{};
+        }
+    catch ( exception& )
+        {
+        return 0;
+        }
+    }
+
+void aclone_cq_destroy(aclone_completion_queue* cq)
+    {
+    delete cq;
+    }
+
+int aclone_cq_fd(const aclone_completion_queue* cq)
+    {
+    return cq->q.descriptor();
+    }
+
+size_t aclone_cq_poll(aclone_completion_queue* cq, size_t max)
+    {
+    return cq->q.poll(max);
+    }
+
+size_t aclone_cq_wait(aclone_completion_queue* cq, size_t max, double timeout)
+    {
+    return cq->q.wait(max, timeout);
+    }
+
+int aclone_context_attach_cq(aclone_context* ctx, aclone_completion_queue* cq)
+    {
+    ctx->cq = cq ? &cq->q : 0;
+    return 1;
+    }
+
 const char* aclone_store_get_topic(const aclone_store* store)
     {
     return store->topic.c_str();
     }
 
+void aclone_master_config_init(aclone_master_config* config)
+    {
+    config->replay_log_size = 65536;
+    config->snapshot_chunk_bytes = 256 * 1024;
+    config->publish_flush_us = 0;
+    config->publish_max_ops = 1024;
+    config->publish_max_bytes = 64 * 1024;
+    config->shards = 1;
+    config->durable_dir = ".";
+    config->compact_bytes = 256 * 1024 * 1024;
+    config->snapshot_codecs = ACLONE_SNAPSHOT_FRONT_CODING | ACLONE_SNAPSHOT_LZ;
+    config->expiry_tick_ms = 10;
+    config->filter_heartbeat_ms = 100;
+    }
+
 aclone_store* aclone_store_open_master(aclone_context* ctx,
                                        const char* topic, int flags)
     {
+    return aclone_store_open_master_config(ctx, topic, flags, 0);
+    }
+
+aclone_store* aclone_store_open_master_config(aclone_context* ctx,
+                                              const char* topic, int flags,
+                                              const aclone_master_config* config)
+    {
     auto it = ctx->masters.find(topic);
 
     if ( it != ctx->masters.end() )
         return it->second;
 
-    auto rval = new aclone_store{ topic, ACLONE_STORE_MODE_MASTER,
-                                  spawn<aclone::master>() };
+    aclone_master_config cfg;
+
+    if ( config )
+        cfg = *config;
+    else
+        aclone_master_config_init(&cfg);
+
+    auto nshards = max(cfg.shards, size_t(1));
+    vector<shared_ptr<aclone::store_stats>> stats;
+    vector<shared_ptr<aclone::durable_log>> wals;
+
+    for ( size_t i = 0; i < nshards; ++i )
+        {
+        stats.push_back(make_shared<aclone::store_stats>());
+
+        if ( ! (flags & ACLONE_MASTER_DURABLE) )
+            continue;
+
+        auto name = string(topic) + "." + to_string(i);
+        auto dir = cfg.durable_dir ? cfg.durable_dir : ".";
+        wals.push_back(make_shared<aclone::durable_log>(dir, name,
+                                                        cfg.compact_bytes,
+                                                        stats[i]));
+
+        try
+            {
+            wals[i]->recover();
+            }
+        catch ( exception& e )
+            {
+            fprintf(stderr, "ERROR: can't recover %s/%s: %s\n", dir,
+                    name.c_str(), e.what());
+            return 0;
+            }
+        }
+
+    auto rval = new aclone_store{ topic, ACLONE_STORE_MODE_MASTER };
+
+    for ( size_t i = 0; i < nshards; ++i )
+        {
+        auto wal = wals.empty() ? nullptr : wals[i];
+        auto a = spawn<aclone::master>(cfg, stats[i], wal);
+        anon_send(a, atom("probe"), aclone::now_ns());
+        rval->shards.emplace_back(a, stats[i]);
+        }
+
     ctx->masters[topic] = rval;
     return rval;
     }
 
+// Registers a master's or relay's shards with the front-end on addr:port.
+static bool publish_shards(aclone_context* ctx, aclone_store* store,
+                           const char* addr, uint16_t port)
+    {
+    // All stores published on the same port share one front-end.
+    auto endpoint = string(addr ? addr : "") + ":" + to_string(port);
+    auto it = ctx->frontends.find(endpoint);
+
+    if ( it == ctx->frontends.end() )
+        {
+        auto frontend = spawn<aclone::frontend>();
+
+        try
+            {
+            publish(frontend, port, addr);
+            }
+        catch ( exception& )
+            {
+            anon_send(frontend, atom("quit"));
+            return false;
+            }
+
+        it = ctx->frontends.emplace(endpoint, frontend).first;
+        }
+
+    aclone::kv_shards shards;
+
+    for ( const auto& s : store->shards )
+        shards.push_back(s.a);
+
+    anon_send(it->second, atom("register"), store->topic, shards);
+
+    if ( find(store->published.begin(), store->published.end(), endpoint) ==
+         store->published.end() )
+        store->published.push_back(endpoint);
+
+    return true;
+    }
+
 int aclone_store_publish_master(aclone_context* ctx, aclone_store* master,
                                 const char* addr, uint16_t port)
     {
     if ( master->mode != ACLONE_STORE_MODE_MASTER )
         return 0;
 
-    try
-        {
-        publish(master->a, port, addr);
-        }
-    catch ( exception& )
-        {
+    return publish_shards(ctx, master, addr, port) ? 1 : 0;
+    }
+
+int aclone_store_publish_relay(aclone_context* ctx, aclone_store* cloner,
+                               const char* addr, uint16_t port)
+    {
+    if ( cloner->mode != ACLONE_STORE_MODE_CLONER )
         return 0;
-        }
+
+    if ( ! publish_shards(ctx, cloner, addr, port) )
+        return 0;
+
+    for ( const auto& s : cloner->shards )
+        anon_send(s.a, atom("relay"));
 
     return 1;
     }
 
+// Seconds to wait for a front-end to describe a topic.  One that accepted
+// the connection but never answers is treated like one that can't be
+// reached.
+static const double topology_timeout = 10;
+
+// The masters a published front-end partitions 'topic' across, if any.
+static aclone::kv_shards topology(const actor& frontend, const string& topic)
+    {
+    aclone_store probe{ "", ACLONE_STORE_MODE_REMOTE };
+    probe.shards.emplace_back(frontend, make_shared<aclone::store_stats>());
+    auto req = make_cow_tuple(atom("topology"), topic);
+    any_tuple resp;
+
+    if ( ! sync_request(&probe, 0, req, resp, topology_timeout) )
+        return {};
+
+    auto resp_opt = tuple_cast<atom_value, aclone::kv_shards>(resp);
+
+    if ( ! resp_opt.valid() )
+        return {};
+
+    return get<1>(*resp_opt);
+    }
+
 aclone_store* aclone_store_open_remote(aclone_context* ctx, const char* topic,
                                        const char* addr, uint16_t port,
                                        int flags)
@@ -92,238 +360,1085 @@ aclone_store* aclone_store_open_remote(aclone_context* ctx, const char* topic,
 
     try
         {
-        remote = remote_actor(addr, port);
+        remote = ctx->peers->connect(addr, port);
         }
     catch ( exception& e)
         {
         return 0;
         }
 
-    return new aclone_store{ topic, ACLONE_STORE_MODE_REMOTE, remote };
+    auto shards = topology(remote, topic);
+
+    if ( shards.empty() )
+        return 0;
+
+    auto rval = new aclone_store{ topic, ACLONE_STORE_MODE_REMOTE };
+
+    for ( const auto& a : shards )
+        rval->shards.emplace_back(a, make_shared<aclone::store_stats>());
+
+    return rval;
     }
 
 aclone_store* aclone_store_open_cloner(aclone_context* ctx, const char* topic,
                                        const char* addr, uint16_t port,
                                        int flags)
     {
-    return new aclone_store{ topic, ACLONE_STORE_MODE_CLONER,
-                             spawn<aclone::cloner>(addr, port) };
+    return aclone_store_open_cloner_config(ctx, topic, addr, port, flags, 0);
     }
 
-int aclone_store_close(aclone_context* ctx, aclone_store* store)
+void aclone_cloner_config_init(aclone_cloner_config* config)
     {
-    if ( store->mode == ACLONE_STORE_MODE_MASTER )
-        ctx->masters.erase(store->topic);
-
-    delete store;
-    return 1;
+    config->persist_dir = ".";
+    config->persist_interval = 300;
+    config->snapshot_codecs = ACLONE_SNAPSHOT_FRONT_CODING | ACLONE_SNAPSHOT_LZ;
+    config->failover = 0;
+    config->relay_log_size = 65536;
+    config->relay_chunk_bytes = 256 * 1024;
+    config->relay_max_subscribers = 0;
+    config->key_prefixes = 0;
+    config->key_prefix_count = 0;
+    config->key_ranges = 0;
+    config->key_range_count = 0;
     }
 
-int aclone_store_clear(aclone_context* ctx, aclone_store* store)
+// Parses a comma-separated list of "addr:port" endpoints, skipping any
+// without a port.
+static vector<aclone::endpoint> parse_endpoints(const char* list)
     {
-    anon_send(store->a, atom("clear"));
-    return 1;
-    }
+    vector<aclone::endpoint> rval;
+    string s = list ? list : "";
+    size_t start = 0;
 
-int aclone_store_insert(aclone_context* ctx, aclone_store* store,
-                        aclone_key key, aclone_val val)
-    {
-    anon_send(store->a, atom("insert"),
-              string(static_cast<const char*>(key.key), key.size),
-              // TODO: fix val type assumption
-              *static_cast<int64_t*>(val.val));
-    return 1;
+    while ( start < s.size() )
+        {
+        auto end = s.find(',', start);
+
+        if ( end == string::npos )
+            end = s.size();
+
+        auto item = s.substr(start, end - start);
+        auto colon = item.rfind(':');
+        start = end + 1;
+
+        if ( colon == string::npos || colon + 1 == item.size() )
+            continue;
+
+        auto port = strtoul(item.c_str() + colon + 1, 0, 10);
+
+        if ( port && port <= UINT16_MAX )
+            rval.emplace_back(item.substr(0, colon), port);
+        }
+
+    return rval;
     }
 
-int aclone_store_remove(aclone_context* ctx, aclone_store* store,
-                        aclone_key key)
+// A key as it can be logged, with bytes that aren't printable escaped.
+static string printable(const string& key)
     {
-    anon_send(store->a, atom("remove"),
-              string(static_cast<const char*>(key.key), key.size));
-    return 1;
+    string rval;
+
+    for ( unsigned char c : key )
+        {
+        if ( isprint(c) && c != '\\' )
+            {
+            rval += c;
+            continue;
+            }
+
+        char buf[8];
+        snprintf(buf, sizeof(buf), "\\x%02x", c);
+        rval += buf;
+        }
+
+    return rval;
     }
 
-int aclone_store_increment(aclone_context* ctx, aclone_store* store,
-                           aclone_key key, aclone_val by)
+// The keys a cloner is configured to replicate.  Throws
+// std::invalid_argument, naming it, for a range with no keys in it.
+static aclone::kv_filter make_filter(const aclone_cloner_config& cfg)
     {
-    anon_send(store->a, atom("increment"),
-              string(static_cast<const char*>(key.key), key.size),
-              // TODO: fix val type assumption
-              *static_cast<int64_t*>(by.val));
-    return 1;
+    auto str = [](aclone_key k)
+        { return string(static_cast<const char*>(k.key), k.size); };
+    aclone::kv_filter rval;
+
+    for ( size_t i = 0; i < cfg.key_prefix_count; ++i )
+        rval.add_prefix(str(cfg.key_prefixes[i]));
+
+    for ( size_t i = 0; i < cfg.key_range_count; ++i )
+        {
+        auto first = str(cfg.key_ranges[i].first);
+        auto last = str(cfg.key_ranges[i].last);
+
+        try
+            {
+            rval.add_range(first, last);
+            }
+        catch ( invalid_argument& e )
+            {
+            throw invalid_argument(string(e.what()) + " key_ranges[" +
+                                   to_string(i) + "]: [\"" +
+                                   printable(first) + "\", \"" +
+                                   printable(last) + "\")");
+            }
+        }
+
+    return rval;
     }
 
-int aclone_store_decrement(aclone_context* ctx, aclone_store* store,
-                           aclone_key key, aclone_val by)
+// Tells apart the files of persistent cloners replicating different keys
+// of a topic, with an FNV-1a hash of the ranges.
+static string filter_tag(const aclone::kv_filter& filter)
     {
-    anon_send(store->a, atom("decrement"),
-              string(static_cast<const char*>(key.key), key.size),
-              // TODO: fix val type assumption
-              *static_cast<int64_t*>(by.val));
-    return 1;
+    if ( filter.all() )
+        return "";
+
+    uint64_t h = 14695981039346656037ull;
+    auto mix = [&](const string& s)
+        {
+        for ( auto c : to_string(s.size()) + ":" + s )
+            {
+            h ^= static_cast<uint8_t>(c);
+            h *= 1099511628211ull;
+            }
+        };
+
+    for ( const auto& r : filter.key_ranges() )
+        {
+        mix(r.first);
+        mix(r.last);
+        }
+
+    char buf[32];
+    snprintf(buf, sizeof(buf), ".%016llx",
+             static_cast<unsigned long long>(h));
+    return buf;
     }
 
-static bool sync_request(const actor& store, const any_tuple& request,
-                         any_tuple& response)
+// A persisted copy of a cloner's shard, or null if there's no usable one.
+static shared_ptr<const aclone::store_file> open_store_file(const string& path)
     {
-    int rval = -1;
-    mutex mtx;
-    condition_variable cv;
-    unique_lock<mutex> guard{mtx};
-    spawn<aclone::sync_requester>(store, mtx, cv, rval, request, response);
-    cv.wait(guard, [&]{ return rval >= 0; });
-    return rval > 0;
+    try
+        {
+        return make_shared<aclone::store_file>(path);
+        }
+    catch ( exception& )
+        {
+        return nullptr;
+        }
     }
 
-static bool lookup_response_extract(const any_tuple& response, aclone_val* val)
+aclone_store* aclone_store_open_cloner_config(aclone_context* ctx,
+                                              const char* topic,
+                                              const char* addr, uint16_t port,
+                                              int flags,
+                                              const aclone_cloner_config* config)
     {
-    auto resp_opt = tuple_cast<atom_value, aclone::val_type>(response);
+    aclone_cloner_config cfg;
 
-    if ( ! resp_opt.valid() )
-        return false;
+    if ( config )
+        cfg = *config;
+    else
+        aclone_cloner_config_init(&cfg);
 
-    auto flag = get<0>(*resp_opt);
+    aclone::kv_filter filter;
 
-    if ( flag == atom("ok") )
+    try
+        {
+        filter = make_filter(cfg);
+        }
+    catch ( exception& e )
         {
-        auto v = get<1>(*resp_opt);
+        fprintf(stderr, "ERROR: can't open cloner of %s: %s\n", topic,
+                e.what());
+        return 0;
+        }
 
-        if ( ! (val->val = malloc(sizeof(v))) )
-            return false;
+    bool persistent = flags & ACLONE_CLONER_PERSISTENT;
+    auto dir = string(cfg.persist_dir ? cfg.persist_dir : ".");
+    auto tag = filter_tag(filter);
+    auto path = [&](size_t shard)
+        {
+        return dir + "/" + topic + tag + "." + to_string(shard) + ".clone";
+        };
 
-        val->size = sizeof(v);
-        memcpy(val->val, &v, sizeof(v));
-        return true;
+    // A master that can't be reached yet, or hasn't published the topic
+    // yet, is assumed to be sharded like the persisted copy, if any, or
+    // else unsharded; if that turns out to be wrong, the cloner complains
+    // when it does connect.
+    size_t shards = 0;
+
+    try
+        {
+        shards = topology(ctx->peers->connect(addr, port), topic).size();
         }
-    else if ( flag == atom("null") )
+    catch ( exception& )
         {
-        val->size = 0;
-        val->val = 0;
-        return true;
         }
-    else
-        return false;
-    }
 
-int aclone_store_lookup_sync(aclone_context* ctx, aclone_store* store,
-                             aclone_key key, aclone_val* result)
-    {
-    auto k = aclone::key_type(static_cast<char*>(key.key), key.size);
-    any_tuple resp;
+    if ( ! shards && persistent )
+        if ( auto f = open_store_file(path(0)) )
+            shards = f->shards();
 
-    if ( ! sync_request(store->a, make_cow_tuple(atom("lookup"), k), resp) )
-        return 0;
+    shards = max(shards, size_t(1));
+    auto rval = new aclone_store{ topic, ACLONE_STORE_MODE_CLONER };
+    vector<aclone::endpoint> parents{aclone::endpoint(addr, port)};
 
-    return lookup_response_extract(resp, result) ? 1 : 0;
-    }
+    for ( auto& e : parse_endpoints(cfg.failover) )
+        parents.push_back(move(e));
 
-static void lookup_cb(aclone_async_result result, const any_tuple& response,
-                      aclone_lookup_cb callback, void* cookie, aclone_key key)
-    {
-    if ( result != ACLONE_ASYNC_SUCCESS )
+    for ( size_t i = 0; i < shards; ++i )
         {
-        callback(result, cookie, key, {0, 0});
-        return;
+        auto stats = make_shared<aclone::store_stats>();
+        auto local = make_shared<aclone::replica>();
+        shared_ptr<const aclone::store_file> warm;
+
+        if ( persistent )
+            warm = open_store_file(path(i));
+
+        if ( warm && ( warm->shard() != i || warm->shards() != shards ) )
+            warm.reset();
+
+        // Reads are served from the file before the cloner even runs.
+        if ( warm )
+            local->preload(warm);
+
+        auto a = spawn<aclone::cloner>(parents, topic, i, shards, ctx->peers,
+                                       stats, local, cfg, filter,
+                                       persistent ? path(i) : string(), warm);
+        anon_send(a, atom("probe"), aclone::now_ns());
+        rval->shards.emplace_back(a, stats, local);
         }
 
-    aclone_val val;
+    return rval;
+    }
 
-    if ( lookup_response_extract(response, &val) )
+int aclone_store_close(aclone_context* ctx, aclone_store* store)
+    {
+    if ( store->mode == ACLONE_STORE_MODE_MASTER )
+        ctx->masters.erase(store->topic);
+
+    aclone::kv_shards shards;
+
+    for ( const auto& s : store->shards )
+        shards.push_back(s.a);
+
+    // Only withdraw the topic where it still names this store's shards; a
+    // relay and its master may share a topic within one context.
+    for ( const auto& endpoint : store->published )
         {
-        callback(result, cookie, key, val);
-        free(val.val);
+        auto it = ctx->frontends.find(endpoint);
+
+        if ( it != ctx->frontends.end() )
+            anon_send(it->second, atom("unregister"), store->topic, shards);
         }
-    else
-        callback(ACLONE_ASYNC_FAILURE, cookie, key, val);
+
+    delete store;
+    return 1;
     }
 
-int aclone_store_lookup_async(aclone_context* ctx, aclone_store* store,
-                              aclone_key key, double timeout,
-                              aclone_lookup_cb callback, void* cookie)
+int aclone_store_clear(aclone_context* ctx, aclone_store* store)
     {
-    using namespace std::placeholders;
-    auto k = aclone::key_type(static_cast<char*>(key.key), key.size);
-    auto bf = bind(lookup_cb, _1, _2, callback, cookie, key);
-    spawn<aclone::async_requester>(store->a, make_cow_tuple(atom("lookup"), k),
-                                   timeout, bf);
+    for ( const auto& s : store->shards )
+        anon_send(s.a, atom("clear"));
+
     return 1;
     }
 
-static bool haskey_response_extract(const any_tuple& response, int* haskey)
+static aclone::val_type make_value(aclone_val val)
     {
-    auto resp_opt = tuple_cast<bool>(response);
+    return aclone::val_type(val.val, val.size);
+    }
 
-    if ( ! resp_opt.valid() )
+// Increments and decrements only apply to 8-byte integers.
+static bool make_amount(aclone_val by, aclone::val_type* amount)
+    {
+    if ( by.size != sizeof(int64_t) )
         return false;
 
-    *haskey = get<0>(*resp_opt) ? 1 : 0;
+    *amount = make_value(by);
     return true;
     }
 
-int aclone_store_haskey_sync(aclone_context* ctx, aclone_store* store,
-                             aclone_key key, int* result)
+int aclone_store_insert(aclone_context* ctx, aclone_store* store,
+                        aclone_key key, aclone_val val)
     {
-    auto k = aclone::key_type(static_cast<char*>(key.key), key.size);
-    any_tuple resp;
-
-    if ( ! sync_request(store->a, make_cow_tuple(atom("haskey"), k), resp) )
-        return 0;
-
-    return haskey_response_extract(resp, result) ? 1 : 0;
+    auto k = string(static_cast<const char*>(key.key), key.size);
+    anon_send(store->route(k), atom("insert"), k, make_value(val));
+    return 1;
     }
 
-static void haskey_cb(aclone_async_result result, const any_tuple& response,
+int aclone_store_remove(aclone_context* ctx, aclone_store* store,
+                        aclone_key key)
+    {
+    auto k = string(static_cast<const char*>(key.key), key.size);
+    anon_send(store->route(k), atom("remove"), k);
+    return 1;
+    }
+
+int aclone_store_insert_ttl(aclone_context* ctx, aclone_store* store,
+                            aclone_key key, aclone_val val, double ttl)
+    {
+    if ( ! (ttl > 0) )
+        return 0;
+
+    auto k = string(static_cast<const char*>(key.key), key.size);
+    auto ttl_ms = static_cast<uint64_t>(ceil(ttl * 1e3));
+    anon_send(store->route(k), atom("insert_ttl"), k, make_value(val), ttl_ms);
+    return 1;
+    }
+
+int aclone_store_increment(aclone_context* ctx, aclone_store* store,
+                           aclone_key key, aclone_val by)
+    {
+    aclone::val_type amount;
+
+    if ( ! make_amount(by, &amount) )
+        return 0;
+
+    auto k = string(static_cast<const char*>(key.key), key.size);
+    anon_send(store->route(k), atom("increment"), k, amount);
+    return 1;
+    }
+
+int aclone_store_decrement(aclone_context* ctx, aclone_store* store,
+                           aclone_key key, aclone_val by)
+    {
+    aclone::val_type amount;
+
+    if ( ! make_amount(by, &amount) )
+        return 0;
+
+    auto k = string(static_cast<const char*>(key.key), key.size);
+    anon_send(store->route(k), atom("decrement"), k, amount);
+    return 1;
+    }
+
+aclone_batch* aclone_batch_create()
+    {
+    return new aclone_batch{};
+    }
+
+void aclone_batch_destroy(aclone_batch* batch)
+    {
+    delete batch;
+    }
+
+void aclone_batch_reset(aclone_batch* batch)
+    {
+    batch->ops.clear();
+    }
+
+size_t aclone_batch_size(const aclone_batch* batch)
+    {
+    return batch->ops.size();
+    }
+
+int aclone_batch_clear(aclone_batch* batch)
+    {
+    batch->ops.push_back({aclone::KV_OP_CLEAR, {}, {}});
+    return 1;
+    }
+
+int aclone_batch_insert(aclone_batch* batch, aclone_key key, aclone_val val)
+    {
+    batch->ops.push_back({aclone::KV_OP_INSERT,
+                          string(static_cast<const char*>(key.key), key.size),
+                          make_value(val)});
+    return 1;
+    }
+
+int aclone_batch_remove(aclone_batch* batch, aclone_key key)
+    {
+    batch->ops.push_back({aclone::KV_OP_REMOVE,
+                          string(static_cast<const char*>(key.key), key.size),
+                          {}});
+    return 1;
+    }
+
+int aclone_batch_increment(aclone_batch* batch, aclone_key key, aclone_val by)
+    {
+    aclone::val_type amount;
+
+    if ( ! make_amount(by, &amount) )
+        return 0;
+
+    batch->ops.push_back({aclone::KV_OP_INCREMENT,
+                          string(static_cast<const char*>(key.key), key.size),
+                          amount});
+    return 1;
+    }
+
+int aclone_batch_decrement(aclone_batch* batch, aclone_key key, aclone_val by)
+    {
+    aclone::val_type amount;
+
+    if ( ! make_amount(by, &amount) )
+        return 0;
+
+    batch->ops.push_back({aclone::KV_OP_DECREMENT,
+                          string(static_cast<const char*>(key.key), key.size),
+                          amount});
+    return 1;
+    }
+
+int aclone_store_apply_batch(aclone_context* ctx, aclone_store* store,
+                             const aclone_batch* batch)
+    {
+    if ( batch->ops.empty() )
+        return 1;
+
+    if ( store->shards.size() == 1 )
+        {
+        anon_send(store->shards[0].a, atom("batch"), batch->ops);
+        return 1;
+        }
+
+    // Each shard gets the ops on its keys, plus every clear, in order.
+    vector<aclone::kv_batch> parts(store->shards.size());
+
+    for ( const auto& u : batch->ops )
+        {
+        if ( u.op == aclone::KV_OP_CLEAR )
+            for ( auto& p : parts )
+                p.push_back(u);
+        else
+            parts[store->shard(u.key)].push_back(u);
+        }
+
+    for ( size_t i = 0; i < parts.size(); ++i )
+        if ( ! parts[i].empty() )
+            anon_send(store->shards[i].a, atom("batch"), parts[i]);
+
+    return 1;
+    }
+
+using shard_request = pair<size_t, any_tuple>;
+using gather_cb = function<void (aclone_async_result, vector<any_tuple>&)>;
+
+// Sends each request to its shard and calls 'cb' once all have completed,
+// with the responses in request order and the first failure or timeout,
+// if any, as the result.  A negative timeout waits indefinitely.
+static void scatter(const aclone_store* store, vector<shard_request> requests,
+                    double timeout, gather_cb cb)
+    {
+    struct gather {
+        mutex mtx;
+        size_t remaining;
+        aclone_async_result result;
+        vector<any_tuple> responses;
+        gather_cb cb;
+    };
+
+    if ( requests.empty() )
+        {
+        vector<any_tuple> none;
+        cb(ACLONE_ASYNC_SUCCESS, none);
+        return;
+        }
+
+    auto g = make_shared<gather>();
+    g->remaining = requests.size();
+    g->result = ACLONE_ASYNC_SUCCESS;
+    g->responses.resize(requests.size());
+    g->cb = move(cb);
+
+    for ( size_t i = 0; i < requests.size(); ++i )
+        {
+        const auto& shard = store->shards[requests[i].first];
+        auto start = aclone::now_ns();
+        auto stats = shard.stats;
+        auto done = [=](aclone_async_result res, const any_tuple& resp)
+            {
+            stats->request_latency.record(aclone::now_ns() - start);
+            unique_lock<mutex> lock{g->mtx};
+
+            if ( g->result == ACLONE_ASYNC_SUCCESS )
+                g->result = res;
+
+            g->responses[i] = resp;
+
+            if ( --g->remaining )
+                return;
+
+            lock.unlock();
+            g->cb(g->result, g->responses);
+            };
+        auto id = shard.requests->add(done);
+
+        if ( ! id )
+            {
+            done(ACLONE_ASYNC_FAILURE, {});
+            continue;
+            }
+
+        anon_send(shard.a, atom("request"), id, shard.channel,
+                  requests[i].second);
+
+        if ( timeout >= 0 )
+            anon_send(shard.channel, atom("deadline"), id,
+                      static_cast<int64_t>(timeout * 1e6));
+        }
+    }
+
+static vector<shard_request> to_all_shards(const aclone_store* store,
+                                           const any_tuple& request)
+    {
+    vector<shard_request> rval;
+
+    for ( size_t i = 0; i < store->shards.size(); ++i )
+        rval.emplace_back(i, request);
+
+    return rval;
+    }
+
+static bool sync_gather(const aclone_store* store,
+                        vector<shard_request> requests,
+                        vector<any_tuple>& responses, double timeout = -1)
+    {
+    using result = pair<aclone_async_result, vector<any_tuple>>;
+    auto done = make_shared<promise<result>>();
+    auto future = done->get_future();
+    scatter(store, move(requests), timeout,
+            [done](aclone_async_result res, vector<any_tuple>& resps)
+                { done->set_value(result{res, move(resps)}); });
+    auto res = future.get();
+
+    if ( res.first != ACLONE_ASYNC_SUCCESS )
+        return false;
+
+    responses = move(res.second);
+    return true;
+    }
+
+static bool sync_request(const aclone_store* store, size_t shard,
+                         const any_tuple& request, any_tuple& response,
+                         double timeout)
+    {
+    vector<any_tuple> responses;
+
+    if ( ! sync_gather(store, {shard_request{shard, request}}, responses,
+                       timeout) )
+        return false;
+
+    response = move(responses[0]);
+    return true;
+    }
+
+// Runs an async callback through the completion queue, if one is attached,
+// including when the request completes (or fails) before it's even sent.
+static void complete(aclone::completion_queue* cq, function<void ()> f)
+    {
+    if ( cq )
+        cq->push(move(f));
+    else
+        f();
+    }
+
+static int async_gather(const aclone_context* ctx, const aclone_store* store,
+                        vector<shard_request> requests, double timeout,
+                        gather_cb cb)
+    {
+    auto cq = ctx->cq;
+    scatter(store, move(requests), timeout,
+            [=](aclone_async_result res, vector<any_tuple>& resps)
+                {
+                complete(cq, [=]() mutable { cb(res, resps); });
+                });
+    return 1;
+    }
+
+static int async_request(const aclone_context* ctx, const aclone_store* store,
+                         size_t shard, const any_tuple& request,
+                         double timeout, aclone::request_cb cb)
+    {
+    return async_gather(ctx, store, {shard_request{shard, request}}, timeout,
+                        [cb](aclone_async_result res, vector<any_tuple>& resps)
+                            { cb(res, resps[0]); });
+    }
+
+// Reads a cloner shard's replica without leaving the calling thread.  These
+// fail if the store isn't a cloner or the replica can't currently answer,
+// and callers then make a request to the actor instead.
+
+static bool local_lookup(const aclone_store* store, const aclone::key_type& k,
+                         bool* found, aclone::val_type* v)
+    {
+    auto& local = store->shards[store->shard(k)].local;
+    return local && local->lookup(k, found, v);
+    }
+
+static bool local_haskey(const aclone_store* store, const aclone::key_type& k,
+                         bool* found)
+    {
+    auto& local = store->shards[store->shard(k)].local;
+    return local && local->haskey(k, found);
+    }
+
+static bool local_size(const aclone_store* store, uint64_t* size)
+    {
+    *size = 0;
+
+    for ( const auto& s : store->shards )
+        {
+        uint64_t n;
+
+        if ( ! s.local || ! s.local->size(&n) )
+            return false;
+
+        *size += n;
+        }
+
+    return true;
+    }
+
+// Copies a value out for the caller, who frees it.  Missing values are null;
+// present ones never are, even when empty.
+static bool make_val(bool found, const aclone::val_type& v, aclone_val* val)
+    {
+    if ( ! found )
+        {
+        val->size = 0;
+        val->val = 0;
+        return true;
+        }
+
+    if ( ! (val->val = malloc(v.size() ? v.size() : 1)) )
+        return false;
+
+    val->size = v.size();
+    memcpy(val->val, v.data(), v.size());
+    return true;
+    }
+
+static bool lookup_response_extract(const any_tuple& response, aclone_val* val)
+    {
+    auto resp_opt = tuple_cast<atom_value, aclone::val_type>(response);
+
+    if ( ! resp_opt.valid() )
+        return false;
+
+    auto flag = get<0>(*resp_opt);
+
+    if ( flag == atom("ok") )
+        return make_val(true, get<1>(*resp_opt), val);
+    else if ( flag == atom("null") )
+        return make_val(false, {}, val);
+    else
+        return false;
+    }
+
+int aclone_store_lookup_sync(aclone_context* ctx, aclone_store* store,
+                             aclone_key key, aclone_val* result)
+    {
+    auto k = aclone::key_type(static_cast<char*>(key.key), key.size);
+    bool found;
+    aclone::val_type v;
+
+    if ( local_lookup(store, k, &found, &v) )
+        return make_val(found, v, result) ? 1 : 0;
+
+    any_tuple resp;
+
+    if ( ! sync_request(store, store->shard(k),
+                        make_cow_tuple(atom("lookup"), k), resp) )
+        return 0;
+
+    return lookup_response_extract(resp, result) ? 1 : 0;
+    }
+
+static void lookup_cb(aclone_async_result result, const any_tuple& response,
+                      aclone_lookup_cb callback, void* cookie, aclone_key key)
+    {
+    if ( result != ACLONE_ASYNC_SUCCESS )
+        {
+        callback(result, cookie, key, {0, 0});
+        return;
+        }
+
+    aclone_val val;
+
+    if ( lookup_response_extract(response, &val) )
+        {
+        callback(result, cookie, key, val);
+        free(val.val);
+        }
+    else
+        callback(ACLONE_ASYNC_FAILURE, cookie, key, val);
+    }
+
+int aclone_store_lookup_async(aclone_context* ctx, aclone_store* store,
+                              aclone_key key, double timeout,
+                              aclone_lookup_cb callback, void* cookie)
+    {
+    using namespace std::placeholders;
+    auto k = aclone::key_type(static_cast<char*>(key.key), key.size);
+    auto bf = bind(lookup_cb, _1, _2, callback, cookie, key);
+    auto req = make_cow_tuple(atom("lookup"), k);
+    return async_request(ctx, store, store->shard(k), req, timeout, bf);
+    }
+
+static bool haskey_response_extract(const any_tuple& response, int* haskey)
+    {
+    auto resp_opt = tuple_cast<bool>(response);
+
+    if ( ! resp_opt.valid() )
+        return false;
+
+    *haskey = get<0>(*resp_opt) ? 1 : 0;
+    return true;
+    }
+
+int aclone_store_haskey_sync(aclone_context* ctx, aclone_store* store,
+                             aclone_key key, int* result)
+    {
+    auto k = aclone::key_type(static_cast<char*>(key.key), key.size);
+    bool found;
+
+    if ( local_haskey(store, k, &found) )
+        {
+        *result = found ? 1 : 0;
+        return 1;
+        }
+
+    any_tuple resp;
+
+    if ( ! sync_request(store, store->shard(k),
+                        make_cow_tuple(atom("haskey"), k), resp) )
+        return 0;
+
+    return haskey_response_extract(resp, result) ? 1 : 0;
+    }
+
+static void haskey_cb(aclone_async_result result, const any_tuple& response,
                       aclone_haskey_cb callback, void* cookie, aclone_key key)
     {
     if ( result != ACLONE_ASYNC_SUCCESS )
         {
-        callback(result, cookie, key, 0);
+        callback(result, cookie, key, 0);
+        return;
+        }
+
+    int exists;
+
+    if ( haskey_response_extract(response, &exists) )
+        callback(result, cookie, key, exists);
+    else
+        callback(ACLONE_ASYNC_FAILURE, cookie, key, exists);
+    }
+
+int aclone_store_haskey_async(aclone_context* ctx, aclone_store* store,
+                              aclone_key key, double timeout,
+                              aclone_haskey_cb callback, void* cookie)
+    {
+    using namespace std::placeholders;
+    auto k = aclone::key_type(static_cast<char*>(key.key), key.size);
+    auto bf = bind(haskey_cb, _1, _2, callback, cookie, key);
+    auto req = make_cow_tuple(atom("haskey"), k);
+    return async_request(ctx, store, store->shard(k), req, timeout, bf);
+    }
+
+// Positions in the caller's key array of the keys sent to each shard.
+using key_positions = vector<vector<size_t>>;
+
+// Splits a multi-key query into one request per shard owning any of the keys.
+static vector<shard_request> partition_keys(const aclone_store* store,
+                                            atom_value query,
+                                            const aclone_key* keys, size_t n,
+                                            key_positions& positions)
+    {
+    vector<aclone::kv_keys> parts(store->shards.size());
+    key_positions part_positions(store->shards.size());
+
+    for ( size_t i = 0; i < n; ++i )
+        {
+        aclone::key_type k(static_cast<char*>(keys[i].key), keys[i].size);
+        auto shard = store->shard(k);
+        parts[shard].push_back(move(k));
+        part_positions[shard].push_back(i);
+        }
+
+    vector<shard_request> rval;
+    positions.clear();
+
+    for ( size_t i = 0; i < parts.size(); ++i )
+        {
+        if ( parts[i].empty() )
+            continue;
+
+        rval.emplace_back(i, make_cow_tuple(query, move(parts[i])));
+        positions.push_back(move(part_positions[i]));
+        }
+
+    return rval;
+    }
+
+static void free_vals(aclone_val* vals, size_t n)
+    {
+    for ( size_t i = 0; i < n; ++i )
+        {
+        free(vals[i].val);
+        vals[i].val = 0;
+        vals[i].size = 0;
+        }
+    }
+
+static bool lookup_multi_response_extract(const vector<any_tuple>& responses,
+                                          const key_positions& positions,
+                                          aclone_val* vals, size_t n)
+    {
+    using vals_type = vector<aclone::val_type>;
+
+    for ( size_t i = 0; i < n; ++i )
+        {
+        vals[i].val = 0;
+        vals[i].size = 0;
+        }
+
+    for ( size_t p = 0; p < responses.size(); ++p )
+        {
+        auto resp_opt = tuple_cast<vector<uint8_t>, vals_type>(responses[p]);
+        const auto& pos = positions[p];
+
+        if ( ! resp_opt.valid() )
+            {
+            free_vals(vals, n);
+            return false;
+            }
+
+        const auto& found = get<0>(*resp_opt);
+        const auto& v = get<1>(*resp_opt);
+
+        if ( found.size() != pos.size() || v.size() != pos.size() )
+            {
+            free_vals(vals, n);
+            return false;
+            }
+
+        for ( size_t i = 0; i < pos.size(); ++i )
+            {
+            if ( ! found[i] )
+                continue;
+
+            if ( ! make_val(true, v[i], &vals[pos[i]]) )
+                {
+                free_vals(vals, n);
+                return false;
+                }
+            }
+        }
+
+    return true;
+    }
+
+static bool local_lookup_multi(const aclone_store* store,
+                               const aclone_key* keys, size_t n,
+                               aclone_val* vals)
+    {
+    for ( size_t i = 0; i < n; ++i )
+        {
+        aclone::key_type k(static_cast<char*>(keys[i].key), keys[i].size);
+        bool found;
+        aclone::val_type v;
+
+        if ( ! local_lookup(store, k, &found, &v) ||
+             ! make_val(found, v, &vals[i]) )
+            {
+            free_vals(vals, i);
+            return false;
+            }
+        }
+
+    return true;
+    }
+
+int aclone_store_lookup_multi_sync(aclone_context* ctx, aclone_store* store,
+                                   const aclone_key* keys, size_t n,
+                                   aclone_val* results)
+    {
+    if ( local_lookup_multi(store, keys, n, results) )
+        return 1;
+
+    key_positions positions;
+    auto reqs = partition_keys(store, atom("lookup_multi"), keys, n,
+                               positions);
+    vector<any_tuple> resps;
+
+    if ( ! sync_gather(store, move(reqs), resps) )
+        return 0;
+
+    return lookup_multi_response_extract(resps, positions, results, n) ? 1 : 0;
+    }
+
+static void lookup_multi_cb(aclone_async_result result,
+                            vector<any_tuple>& responses,
+                            const key_positions& positions,
+                            aclone_lookup_multi_cb callback, void* cookie,
+                            const aclone_key* keys, size_t n)
+    {
+    vector<aclone_val> vals(n, aclone_val{0, 0});
+
+    if ( result != ACLONE_ASYNC_SUCCESS )
+        {
+        callback(result, cookie, keys, vals.data(), n);
         return;
         }
 
-    int exists;
+    if ( lookup_multi_response_extract(responses, positions, vals.data(), n) )
+        {
+        callback(result, cookie, keys, vals.data(), n);
+        free_vals(vals.data(), n);
+        }
+    else
+        callback(ACLONE_ASYNC_FAILURE, cookie, keys, vals.data(), n);
+    }
 
-    if ( haskey_response_extract(response, &exists) )
-        callback(result, cookie, key, exists);
+int aclone_store_lookup_multi_async(aclone_context* ctx, aclone_store* store,
+                                    const aclone_key* keys, size_t n,
+                                    double timeout,
+                                    aclone_lookup_multi_cb callback,
+                                    void* cookie)
+    {
+    using namespace std::placeholders;
+    key_positions positions;
+    auto reqs = partition_keys(store, atom("lookup_multi"), keys, n,
+                               positions);
+    auto bf = bind(lookup_multi_cb, _1, _2, move(positions), callback, cookie,
+                   keys, n);
+    return async_gather(ctx, store, move(reqs), timeout, bf);
+    }
+
+static bool haskey_multi_response_extract(const vector<any_tuple>& responses,
+                                          const key_positions& positions,
+                                          int* exists, size_t n)
+    {
+    for ( size_t p = 0; p < responses.size(); ++p )
+        {
+        auto resp_opt = tuple_cast<vector<uint8_t>>(responses[p]);
+        const auto& pos = positions[p];
+
+        if ( ! resp_opt.valid() )
+            return false;
+
+        const auto& found = get<0>(*resp_opt);
+
+        if ( found.size() != pos.size() )
+            return false;
+
+        for ( size_t i = 0; i < pos.size(); ++i )
+            exists[pos[i]] = found[i] ? 1 : 0;
+        }
+
+    return true;
+    }
+
+static bool local_haskey_multi(const aclone_store* store,
+                               const aclone_key* keys, size_t n,
+                               int* exists)
+    {
+    for ( size_t i = 0; i < n; ++i )
+        {
+        aclone::key_type k(static_cast<char*>(keys[i].key), keys[i].size);
+        bool found;
+
+        if ( ! local_haskey(store, k, &found) )
+            return false;
+
+        exists[i] = found ? 1 : 0;
+        }
+
+    return true;
+    }
+
+int aclone_store_haskey_multi_sync(aclone_context* ctx, aclone_store* store,
+                                   const aclone_key* keys, size_t n,
+                                   int* results)
+    {
+    if ( local_haskey_multi(store, keys, n, results) )
+        return 1;
+
+    key_positions positions;
+    auto reqs = partition_keys(store, atom("haskey_multi"), keys, n,
+                               positions);
+    vector<any_tuple> resps;
+
+    if ( ! sync_gather(store, move(reqs), resps) )
+        return 0;
+
+    return haskey_multi_response_extract(resps, positions, results, n) ? 1 : 0;
+    }
+
+static void haskey_multi_cb(aclone_async_result result,
+                            vector<any_tuple>& responses,
+                            const key_positions& positions,
+                            aclone_haskey_multi_cb callback, void* cookie,
+                            const aclone_key* keys, size_t n)
+    {
+    vector<int> exists(n, 0);
+
+    if ( result != ACLONE_ASYNC_SUCCESS )
+        {
+        callback(result, cookie, keys, exists.data(), n);
+        return;
+        }
+
+    if ( haskey_multi_response_extract(responses, positions, exists.data(), n) )
+        callback(result, cookie, keys, exists.data(), n);
     else
-        callback(ACLONE_ASYNC_FAILURE, cookie, key, exists);
+        callback(ACLONE_ASYNC_FAILURE, cookie, keys, exists.data(), n);
     }
 
-int aclone_store_haskey_async(aclone_context* ctx, aclone_store* store,
-                              aclone_key key, double timeout,
-                              aclone_haskey_cb callback, void* cookie)
+int aclone_store_haskey_multi_async(aclone_context* ctx, aclone_store* store,
+                                    const aclone_key* keys, size_t n,
+                                    double timeout,
+                                    aclone_haskey_multi_cb callback,
+                                    void* cookie)
     {
     using namespace std::placeholders;
-    auto k = aclone::key_type(static_cast<char*>(key.key), key.size);
-    auto bf = bind(haskey_cb, _1, _2, callback, cookie, key);
-    spawn<aclone::async_requester>(store->a, make_cow_tuple(atom("haskey"), k),
-                                   timeout, bf);
-    return 1;
+    key_positions positions;
+    auto reqs = partition_keys(store, atom("haskey_multi"), keys, n,
+                               positions);
+    auto bf = bind(haskey_multi_cb, _1, _2, move(positions), callback, cookie,
+                   keys, n);
+    return async_gather(ctx, store, move(reqs), timeout, bf);
     }
 
-static bool size_response_extract(const any_tuple& response, uint64_t* size)
+// The size of a sharded store is the sum over its shards.
+static bool size_response_extract(const vector<any_tuple>& responses,
+                                  uint64_t* size)
     {
-    auto resp_opt = tuple_cast<uint64_t>(response);
+    *size = 0;
 
-    if ( ! resp_opt.valid() )
-        return false;
+    for ( const auto& response : responses )
+        {
+        auto resp_opt = tuple_cast<uint64_t>(response);
+
+        if ( ! resp_opt.valid() )
+            return false;
+
+        *size += get<0>(*resp_opt);
+        }
 
-    *size = get<0>(*resp_opt);
     return true;
     }
 
 int aclone_store_size_sync(aclone_context* ctx, aclone_store* store,
                            uint64_t* result)
     {
-    any_tuple resp;
+    if ( local_size(store, result) )
+        return 1;
 
-    if ( ! sync_request(store->a, make_cow_tuple(atom("size")), resp) )
+    auto reqs = to_all_shards(store, make_cow_tuple(atom("size")));
+    vector<any_tuple> resps;
+
+    if ( ! sync_gather(store, move(reqs), resps) )
         return 0;
 
-    return size_response_extract(resp, result) ? 1 : 0;
+    return size_response_extract(resps, result) ? 1 : 0;
     }
 
-static void size_cb(aclone_async_result result, const any_tuple& response,
+static void size_cb(aclone_async_result result,
+                    vector<any_tuple>& response,
                     aclone_size_cb callback, void* cookie)
     {
     if ( result != ACLONE_ASYNC_SUCCESS )
@@ -346,7 +1461,327 @@ int aclone_store_size_async(aclone_context* ctx, aclone_store* store,
     {
     using namespace std::placeholders;
     auto bf = bind(size_cb, _1, _2, callback, cookie);
-    spawn<aclone::async_requester>(store->a, make_cow_tuple(atom("size")),
-                                   timeout, bf);
+    auto reqs = to_all_shards(store, make_cow_tuple(atom("size")));
+    return async_gather(ctx, store, move(reqs), timeout, bf);
+    }
+
+static bool fetch_add_response_extract(const any_tuple& response,
+                                       int64_t* previous)
+    {
+    auto resp_opt = tuple_cast<atom_value, int64_t>(response);
+
+    if ( ! resp_opt.valid() || get<0>(*resp_opt) != atom("ok") )
+        return false;
+
+    *previous = get<1>(*resp_opt);
+    return true;
+    }
+
+int aclone_store_fetch_add_sync(aclone_context* ctx, aclone_store* store,
+                                aclone_key key, aclone_val by,
+                                int64_t* previous)
+    {
+    aclone::val_type amount;
+
+    if ( ! make_amount(by, &amount) )
+        return 0;
+
+    auto k = aclone::key_type(static_cast<char*>(key.key), key.size);
+    any_tuple resp;
+
+    if ( ! sync_request(store, store->shard(k),
+                        make_cow_tuple(atom("fetch_add"), k, amount), resp) )
+        return 0;
+
+    return fetch_add_response_extract(resp, previous) ? 1 : 0;
+    }
+
+static void fetch_add_cb(aclone_async_result result,
+                         const any_tuple& response,
+                         aclone_fetch_add_cb callback, void* cookie,
+                         aclone_key key)
+    {
+    if ( result != ACLONE_ASYNC_SUCCESS )
+        {
+        callback(result, cookie, key, 0);
+        return;
+        }
+
+    int64_t previous = 0;
+
+    if ( fetch_add_response_extract(response, &previous) )
+        callback(result, cookie, key, previous);
+    else
+        callback(ACLONE_ASYNC_FAILURE, cookie, key, previous);
+    }
+
+int aclone_store_fetch_add_async(aclone_context* ctx, aclone_store* store,
+                                 aclone_key key, aclone_val by,
+                                 double timeout,
+                                 aclone_fetch_add_cb callback, void* cookie)
+    {
+    using namespace std::placeholders;
+    aclone::val_type amount;
+
+    if ( ! make_amount(by, &amount) )
+        return 0;
+
+    auto k = aclone::key_type(static_cast<char*>(key.key), key.size);
+    auto bf = bind(fetch_add_cb, _1, _2, callback, cookie, key);
+    auto req = make_cow_tuple(atom("fetch_add"), k, amount);
+    return async_request(ctx, store, store->shard(k), req, timeout, bf);
+    }
+
+static any_tuple cas_request(const aclone::key_type& k, aclone_val expected,
+                             aclone_val desired)
+    {
+    auto expect_present = expected.val != 0;
+    return make_cow_tuple(atom("cas"), k, expect_present,
+                          expect_present ? make_value(expected)
+                                         : aclone::val_type{},
+                          make_value(desired));
+    }
+
+static bool cas_response_extract(const any_tuple& response, int* swapped,
+                                 aclone_val* previous)
+    {
+    auto resp_opt = tuple_cast<bool, bool, aclone::val_type>(response);
+
+    if ( ! resp_opt.valid() )
+        return false;
+
+    *swapped = get<0>(*resp_opt) ? 1 : 0;
+    return ! previous || make_val(get<1>(*resp_opt), get<2>(*resp_opt),
+                                  previous);
+    }
+
+int aclone_store_cas_sync(aclone_context* ctx, aclone_store* store,
+                          aclone_key key, aclone_val expected,
+                          aclone_val desired, int* swapped,
+                          aclone_val* previous)
+    {
+    auto k = aclone::key_type(static_cast<char*>(key.key), key.size);
+    any_tuple resp;
+
+    if ( ! sync_request(store, store->shard(k),
+                        cas_request(k, expected, desired), resp) )
+        return 0;
+
+    return cas_response_extract(resp, swapped, previous) ? 1 : 0;
+    }
+
+static void cas_cb(aclone_async_result result, const any_tuple& response,
+                   aclone_cas_cb callback, void* cookie, aclone_key key)
+    {
+    if ( result != ACLONE_ASYNC_SUCCESS )
+        {
+        callback(result, cookie, key, 0, {0, 0});
+        return;
+        }
+
+    int swapped = 0;
+    aclone_val previous;
+
+    if ( cas_response_extract(response, &swapped, &previous) )
+        {
+        callback(result, cookie, key, swapped, previous);
+        free(previous.val);
+        }
+    else
+        callback(ACLONE_ASYNC_FAILURE, cookie, key, swapped, {0, 0});
+    }
+
+int aclone_store_cas_async(aclone_context* ctx, aclone_store* store,
+                           aclone_key key, aclone_val expected,
+                           aclone_val desired, double timeout,
+                           aclone_cas_cb callback, void* cookie)
+    {
+    using namespace std::placeholders;
+    auto k = aclone::key_type(static_cast<char*>(key.key), key.size);
+    auto bf = bind(cas_cb, _1, _2, callback, cookie, key);
+    auto req = cas_request(k, expected, desired);
+    return async_request(ctx, store, store->shard(k), req, timeout, bf);
+    }
+
+aclone_cursor* aclone_cursor_open(aclone_context* ctx, aclone_store* store,
+                                  aclone_key prefix, size_t page_size,
+                                  int with_values)
+    {
+    auto rval = new aclone_cursor{};
+    rval->store = store;
+    rval->prefix.assign(static_cast<char*>(prefix.key), prefix.size);
+    rval->page_size = page_size ? page_size : 1024;
+    rval->with_values = with_values;
+    return rval;
+    }
+
+void aclone_cursor_close(aclone_context* ctx, aclone_cursor* cursor)
+    {
+    delete cursor;
+    }
+
+static any_tuple cursor_request(const aclone_cursor* cursor)
+    {
+    return make_cow_tuple(atom("keys"), cursor->prefix, cursor->last,
+                          cursor->started, cursor->page_size,
+                          cursor->with_values);
+    }
+
+static void cursor_advance(aclone_cursor* cursor, bool shard_done)
+    {
+    if ( ! cursor->keys.empty() )
+        {
+        cursor->last = cursor->keys.back();
+        cursor->started = true;
+        }
+
+    if ( ! shard_done )
+        return;
+
+    if ( cursor->shard + 1 < cursor->store->shards.size() )
+        {
+        ++cursor->shard;
+        cursor->last.clear();
+        cursor->started = false;
+        }
+    else
+        cursor->done = true;
+    }
+
+static bool cursor_page_extract(const any_tuple& response,
+                                aclone_cursor* cursor)
+    {
+    using vals_type = vector<aclone::val_type>;
+    auto resp_opt = tuple_cast<aclone::kv_keys, vals_type, bool>(response);
+
+    if ( ! resp_opt.valid() )
+        return false;
+
+    auto& keys = get<0>(*resp_opt);
+    auto& vals = get<1>(*resp_opt);
+
+    if ( cursor->with_values && vals.size() != keys.size() )
+        return false;
+
+    cursor->keys = keys;
+    cursor->vals = vals;
+    cursor->key_views.clear();
+    cursor->val_views.clear();
+
+    for ( auto& k : cursor->keys )
+        cursor->key_views.push_back({&k[0], k.size()});
+
+    for ( auto& v : cursor->vals )
+        cursor->val_views.push_back({const_cast<char*>(v.data()), v.size()});
+
+    cursor_advance(cursor, get<2>(*resp_opt));
+    return true;
+    }
+
+static void cursor_page(const aclone_cursor* cursor, const aclone_key** keys,
+                        const aclone_val** vals, size_t* n)
+    {
+    *n = cursor->key_views.size();
+    *keys = cursor->key_views.data();
+    *vals = cursor->with_values ? cursor->val_views.data() : 0;
+    }
+
+int aclone_cursor_next_sync(aclone_context* ctx, aclone_cursor* cursor,
+                            const aclone_key** keys, const aclone_val** vals,
+                            size_t* n)
+    {
+    if ( cursor->done )
+        {
+        cursor->key_views.clear();
+        cursor->val_views.clear();
+        cursor_page(cursor, keys, vals, n);
+        return 1;
+        }
+
+    // Shards that have nothing (more) to scan yield empty pages, which only
+    // the final one may hand back.
+    do
+        {
+        any_tuple resp;
+
+        if ( ! sync_request(cursor->store, cursor->shard,
+                            cursor_request(cursor), resp) )
+            return 0;
+
+        if ( ! cursor_page_extract(resp, cursor) )
+            return 0;
+        } while ( cursor->keys.empty() && ! cursor->done );
+
+    cursor_page(cursor, keys, vals, n);
+    return 1;
+    }
+
+static void cursor_cb(aclone_async_result result, const any_tuple& response,
+                      aclone_context* ctx, double timeout,
+                      aclone_cursor_cb callback, void* cookie,
+                      aclone_cursor* cursor)
+    {
+    if ( result != ACLONE_ASYNC_SUCCESS )
+        {
+        callback(result, cookie, cursor, 0, 0, 0);
+        return;
+        }
+
+    if ( ! cursor_page_extract(response, cursor) )
+        {
+        callback(ACLONE_ASYNC_FAILURE, cookie, cursor, 0, 0, 0);
+        return;
+        }
+
+    if ( cursor->keys.empty() && ! cursor->done )
+        {
+        aclone_cursor_next_async(ctx, cursor, timeout, callback, cookie);
+        return;
+        }
+
+    const aclone_key* keys;
+    const aclone_val* vals;
+    size_t n;
+    cursor_page(cursor, &keys, &vals, &n);
+    callback(result, cookie, cursor, keys, vals, n);
+    }
+
+int aclone_cursor_next_async(aclone_context* ctx, aclone_cursor* cursor,
+                             double timeout, aclone_cursor_cb callback,
+                             void* cookie)
+    {
+    using namespace std::placeholders;
+
+    if ( cursor->done )
+        {
+        complete(ctx->cq, [=]()
+            { callback(ACLONE_ASYNC_SUCCESS, cookie, cursor, 0, 0, 0); });
+        return 1;
+        }
+
+    auto bf = bind(cursor_cb, _1, _2, ctx, timeout, callback, cookie, cursor);
+    return async_request(ctx, cursor->store, cursor->shard,
+                         cursor_request(cursor), timeout, bf);
+    }
+
+int aclone_store_stats(aclone_context* ctx, aclone_store* store,
+                       aclone_stats* stats)
+    {
+    *stats = aclone_stats{};
+
+    for ( const auto& s : store->shards )
+        s.stats->add_to(stats);
+
+    return 1;
+    }
+
+int aclone_store_dump(aclone_context* ctx, aclone_store* store)
+    {
+    if ( store->mode == ACLONE_STORE_MODE_REMOTE )
+        return 0;
+
+    for ( const auto& s : store->shards )
+        anon_send(s.a, atom("dump"));
+
     return 1;
     }
@@ -1,5 +1,7 @@
 #include <string>
+#include <vector>
 #include <cstdint>
+#include <cstring>
 #include <getopt.h>
 
 #include <cppa/cppa.hpp>
@@ -24,6 +26,11 @@ static void usage(const string& program)
     fprintf(stderr, "    -u|--updater     | sends updates periodically\n");
     fprintf(stderr, "    -k|--key         | key to update/request\n");
     fprintf(stderr, "    -f|--freq        | frequency to update/request\n");
+    fprintf(stderr, "    -s|--shards      | number of master shards\n");
+    fprintf(stderr, "    -d|--durable     | dir to persist store in\n");
+    fprintf(stderr, "    -l|--relay       | port to relay cloned updates on\n");
+    fprintf(stderr, "    -o|--failover    | more addr:port to clone from\n");
+    fprintf(stderr, "    -x|--prefix      | clone only keys with prefix\n");
     }
 
 static option long_options[] = {
@@ -35,9 +42,26 @@ static option long_options[] = {
     {"updater",      no_argument,          0, 'u'},
     {"key",          required_argument,    0, 'k'},
     {"freq",         required_argument,    0, 'f'},
+    {"shards",       required_argument,    0, 's'},
+    {"durable",      required_argument,    0, 'd'},
+    {"relay",        required_argument,    0, 'l'},
+    {"failover",     required_argument,    0, 'o'},
+    {"prefix",       required_argument,    0, 'x'},
 };
 
-static const char* opt_string = "p:a:k:f:mcru";
+static const char* opt_string = "p:a:k:f:s:d:l:o:x:mcru";
+
+// Values the updater writes are 8-byte integers; show others as text.
+static string val_string(aclone_val v)
+    {
+    if ( ! v.val )
+        return "null";
+
+    if ( v.size == sizeof(int64_t) )
+        return to_string(*static_cast<int64_t*>(v.val));
+
+    return string(static_cast<const char*>(v.val), v.size);
+    }
 
 enum KVmode {
     KV_MODE_MASTER,
@@ -48,14 +72,17 @@ enum KVmode {
 
 int main(int argc, char** argv)
     {
-    announce<kv_sequence>(&kv_sequence::sequence);
-    announce<kv_store>(&kv_store::store, &kv_store::sequence);
     KVmode mode = KV_MODE_MASTER;
     string portstr = "9999";
     string key = "testkey";
     string freqstr = "1";
+    string shardstr = "1";
     string addr = "127.0.0.1";
     const char* topic = "dummy";
+    const char* durable_dir = 0;
+    const char* relay_port = 0;
+    const char* failover = 0;
+    vector<aclone_key> prefixes;
 
     for ( ; ; )
         {
@@ -89,6 +116,21 @@ int main(int argc, char** argv)
         case 'f':
             freqstr = optarg;
             break;
+        case 's':
+            shardstr = optarg;
+            break;
+        case 'd':
+            durable_dir = optarg;
+            break;
+        case 'l':
+            relay_port = optarg;
+            break;
+        case 'o':
+            failover = optarg;
+            break;
+        case 'x':
+            prefixes.push_back(aclone_key{optarg, strlen(optarg)});
+            break;
         default:
             usage(argv[0]);
             return 1;
@@ -104,14 +146,52 @@ int main(int argc, char** argv)
         {
         //auto mstr = spawn<master>();
         //publish(mstr, port, addr.c_str());
-        aclone_store* master = aclone_store_open_master(ctx, topic, 0);
+        aclone_master_config config;
+        aclone_master_config_init(&config);
+        config.shards = stoul(shardstr);
+        int flags = 0;
+
+        if ( durable_dir )
+            {
+            config.durable_dir = durable_dir;
+            flags |= ACLONE_MASTER_DURABLE;
+            }
+
+        aclone_store* master = aclone_store_open_master_config(ctx, topic,
+                                                               flags, &config);
+
+        if ( ! master )
+            {
+            fprintf(stderr, "Failed to open master.\n");
+            return 1;
+            }
+
         aclone_store_publish_master(ctx, master, addr.c_str(), port);
         }
         break;
     case KV_MODE_CLONER:
         {
         //spawn<cloner>(addr, port);
-        aclone_store_open_cloner(ctx, topic, addr.c_str(), port, 0);
+        aclone_cloner_config config;
+        aclone_cloner_config_init(&config);
+        int flags = 0;
+
+        if ( durable_dir )
+            {
+            config.persist_dir = durable_dir;
+            flags |= ACLONE_CLONER_PERSISTENT;
+            }
+
+        config.failover = failover;
+        config.key_prefixes = prefixes.data();
+        config.key_prefix_count = prefixes.size();
+        aclone_store* cloner = aclone_store_open_cloner_config(ctx, topic,
+                                                               addr.c_str(),
+                                                               port, flags,
+                                                               &config);
+
+        if ( cloner && relay_port )
+            aclone_store_publish_relay(ctx, cloner, 0, stoul(relay_port));
         }
         break;
     case KV_MODE_REQUESTER:
@@ -150,7 +230,7 @@ int main(int argc, char** argv)
 
                 if ( res )
                     cout << "Value of key '" << key << "': "
-                         << *static_cast<int64_t*>(v.val) << endl;
+                         << val_string(v) << endl;
                 else
                     cout << "Failed to lookup key." << endl;
 
@@ -188,14 +268,7 @@ int main(int argc, char** argv)
                         {
                         string keystr(static_cast<const char*>(key.key),
                                       key.size);
-                        stringstream ss;
-
-                        if ( val.val )
-                            ss << *static_cast<int64_t*>(val.val);
-                        else
-                            ss << "null";
-
-                        string valstr = ss.str();
+                        string valstr = val_string(val);
 
                         cout << *static_cast<string*>(cookie) << " lookup '"
                              << keystr << "': " << valstr << endl;